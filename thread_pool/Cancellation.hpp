@@ -0,0 +1,90 @@
+#pragma once
+#include <atomic>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+
+namespace toys
+{
+
+// what a cancelled add_cancellable() future holds, and what throw_if_cancelled() throws
+class TaskCancelled : public std::runtime_error
+{
+  public:
+    TaskCancelled();
+};
+
+// Read side of a CancellationSource, cheap to copy into tasks. A default constructed token is never cancelled.
+class CancellationToken
+{
+  private:
+    // var
+    std::shared_ptr<std::atomic<bool>> m_cancelled;
+
+  public:
+    // func
+    CancellationToken() = default;
+    explicit CancellationToken(std::shared_ptr<std::atomic<bool>> cancelled);
+
+    bool is_cancelled() const;
+    // for long running tasks: poll between steps and unwind with TaskCancelled
+    void throw_if_cancelled() const;
+};
+
+// cancel() is sticky and reaches every token handed out, before or after the call
+class CancellationSource
+{
+  private:
+    // var
+    std::shared_ptr<std::atomic<bool>> m_cancelled;
+
+  public:
+    // func
+    CancellationSource();
+
+    void cancel();
+    bool is_cancelled() const;
+    CancellationToken token() const;
+};
+
+TaskCancelled::TaskCancelled() : std::runtime_error("task cancelled")
+{
+}
+
+CancellationToken::CancellationToken(std::shared_ptr<std::atomic<bool>> cancelled) : m_cancelled(std::move(cancelled))
+{
+}
+
+bool CancellationToken::is_cancelled() const
+{
+    return m_cancelled && m_cancelled->load(std::memory_order_acquire);
+}
+
+void CancellationToken::throw_if_cancelled() const
+{
+    if (is_cancelled())
+    {
+        throw TaskCancelled();
+    }
+}
+
+CancellationSource::CancellationSource() : m_cancelled(std::make_shared<std::atomic<bool>>(false))
+{
+}
+
+void CancellationSource::cancel()
+{
+    m_cancelled->store(true, std::memory_order_release);
+}
+
+bool CancellationSource::is_cancelled() const
+{
+    return m_cancelled->load(std::memory_order_acquire);
+}
+
+CancellationToken CancellationSource::token() const
+{
+    return CancellationToken(m_cancelled);
+}
+
+} // namespace toys
@@ -0,0 +1,244 @@
+#pragma once
+#include "Future.hpp"
+#include "ThreadPool.hpp"
+#if !defined(__cpp_impl_coroutine)
+#error "Coroutine.hpp needs C++20 coroutines"
+#endif
+#include <coroutine>
+#include <exception>
+#include <future>
+#include <optional>
+#include <utility>
+
+namespace toys
+{
+
+// Named CoTask rather than Task, toys::Task is the timer entry in Timer.hpp.
+template <typename T> class CoTask;
+
+struct CoTaskPromiseBase
+{
+    // resumes whoever co_awaited the task, by symmetric transfer so deep chains do not grow the stack
+    struct FinalAwaiter
+    {
+        bool await_ready() noexcept
+        {
+            return false;
+        }
+        template <typename P> std::coroutine_handle<> await_suspend(std::coroutine_handle<P> handle) noexcept
+        {
+            std::coroutine_handle<> continuation = handle.promise().continuation;
+            return continuation ? continuation : std::noop_coroutine();
+        }
+        void await_resume() noexcept
+        {
+        }
+    };
+
+    std::coroutine_handle<> continuation;
+    std::exception_ptr error;
+
+    std::suspend_always initial_suspend() noexcept
+    {
+        return {};
+    }
+    FinalAwaiter final_suspend() noexcept
+    {
+        return {};
+    }
+    void unhandled_exception()
+    {
+        error = std::current_exception();
+    }
+};
+
+template <typename T> struct CoTaskPromise : CoTaskPromiseBase
+{
+    std::optional<T> value;
+
+    CoTask<T> get_return_object();
+    template <typename U> void return_value(U &&result)
+    {
+        value.emplace(std::forward<U>(result));
+    }
+    T result()
+    {
+        if (error)
+        {
+            std::rethrow_exception(error);
+        }
+        return std::move(*value);
+    }
+};
+
+template <> struct CoTaskPromise<void> : CoTaskPromiseBase
+{
+    CoTask<void> get_return_object();
+    void return_void()
+    {
+    }
+    void result()
+    {
+        if (error)
+        {
+            std::rethrow_exception(error);
+        }
+    }
+};
+
+// Lazy coroutine: the body starts when the task is co_awaited, and finishing it resumes the awaiting
+// coroutine on the same thread. Put co_await pool.schedule() in the body to run it on a pool worker.
+template <typename T> class CoTask
+{
+  public:
+    using promise_type = CoTaskPromise<T>;
+
+  private:
+    struct Awaiter
+    {
+        std::coroutine_handle<promise_type> handle;
+
+        bool await_ready() noexcept
+        {
+            return false;
+        }
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+        {
+            handle.promise().continuation = awaiting;
+            return handle;
+        }
+        T await_resume()
+        {
+            return handle.promise().result();
+        }
+    };
+
+    // var
+    std::coroutine_handle<promise_type> m_handle;
+
+  public:
+    // func
+    explicit CoTask(std::coroutine_handle<promise_type> handle);
+    CoTask(CoTask &&other) noexcept;
+    CoTask &operator=(CoTask &&other) noexcept;
+    CoTask(const CoTask &) = delete;
+    CoTask &operator=(const CoTask &) = delete;
+    ~CoTask();
+
+    Awaiter operator co_await() noexcept;
+};
+
+template <typename T> CoTask<T> CoTaskPromise<T>::get_return_object()
+{
+    return CoTask<T>(std::coroutine_handle<CoTaskPromise<T>>::from_promise(*this));
+}
+
+CoTask<void> CoTaskPromise<void>::get_return_object()
+{
+    return CoTask<void>(std::coroutine_handle<CoTaskPromise<void>>::from_promise(*this));
+}
+
+template <typename T> CoTask<T>::CoTask(std::coroutine_handle<promise_type> handle) : m_handle(handle)
+{
+}
+
+template <typename T> CoTask<T>::CoTask(CoTask &&other) noexcept : m_handle(std::exchange(other.m_handle, nullptr))
+{
+}
+
+template <typename T> CoTask<T> &CoTask<T>::operator=(CoTask &&other) noexcept
+{
+    if (this != &other)
+    {
+        if (m_handle)
+        {
+            m_handle.destroy();
+        }
+        m_handle = std::exchange(other.m_handle, nullptr);
+    }
+    return *this;
+}
+
+template <typename T> CoTask<T>::~CoTask()
+{
+    if (m_handle)
+    {
+        m_handle.destroy();
+    }
+}
+
+template <typename T> typename CoTask<T>::Awaiter CoTask<T>::operator co_await() noexcept
+{
+    return Awaiter{m_handle};
+}
+
+// eager coroutine that frees its own frame, used to drive a CoTask from ordinary code
+struct DetachedCoroutine
+{
+    struct promise_type
+    {
+        DetachedCoroutine get_return_object()
+        {
+            return {};
+        }
+        std::suspend_never initial_suspend() noexcept
+        {
+            return {};
+        }
+        std::suspend_never final_suspend() noexcept
+        {
+            return {};
+        }
+        void return_void()
+        {
+        }
+        void unhandled_exception()
+        {
+            std::terminate();
+        }
+    };
+};
+
+template <typename T, typename P> DetachedCoroutine run_co_task(CoTask<T> task, P promise, ThreadPool *pool)
+{
+    if (pool != nullptr)
+    {
+        co_await pool->schedule();
+    }
+    try
+    {
+        if constexpr (std::is_void<T>::value)
+        {
+            co_await task;
+            promise.set_value();
+        }
+        else
+        {
+            promise.set_value(co_await task);
+        }
+    }
+    catch (...)
+    {
+        promise.set_exception(std::current_exception());
+    }
+}
+
+// blocks the calling thread until task finishes; do not call it from a pool worker
+template <typename T> T sync_wait(CoTask<T> task)
+{
+    std::promise<T> promise;
+    std::future<T> result = promise.get_future();
+    run_co_task(std::move(task), std::move(promise), nullptr);
+    return result.get();
+}
+
+// starts task on a pool worker, the Future supports then/when_all/when_any
+template <typename T> Future<T> co_spawn(ThreadPool &pool, CoTask<T> task)
+{
+    Promise<T> promise(&pool);
+    Future<T> result = promise.get_future();
+    run_co_task(std::move(task), std::move(promise), &pool);
+    return result;
+}
+
+} // namespace toys
@@ -0,0 +1,34 @@
+// g++ -std=c++20 Coroutine_example.cpp -lpthread
+#include "Coroutine.hpp"
+#include <iostream>
+#include <vector>
+
+toys::CoTask<int> load(toys::ThreadPool &tp, int id)
+{
+    co_await tp.schedule();
+    co_return id * 10;
+}
+
+toys::CoTask<int> handle_request(toys::ThreadPool &tp, int id)
+{
+    int a = co_await load(tp, id);
+    int b = co_await load(tp, id + 1);
+    co_return a + b;
+}
+
+int main(int argc, char **argv)
+{
+    toys::ThreadPool tp(3);
+
+    std::cout << toys::sync_wait(handle_request(tp, 1)) << std::endl;
+
+    std::vector<toys::Future<int>> requests;
+    for (int i = 0; i < 10000; i++)
+    {
+        requests.push_back(toys::co_spawn(tp, handle_request(tp, i)));
+    }
+    std::vector<int> results = toys::when_all(std::move(requests)).get();
+    std::cout << results.size() << " " << results.back() << std::endl;
+
+    return 0;
+}
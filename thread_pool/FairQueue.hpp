@@ -0,0 +1,125 @@
+#pragma once
+#include "RingQueue.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace toys
+{
+
+// FIFO per flow, served by deficit round robin: every visit to a non-empty flow adds its weight to the flow's
+// deficit, each pop costs 1, and the flow keeps being served until its deficit runs out. Over a round a flow gets
+// weight / (sum of the busy flows' weights) of the pops however many entries it queued. An emptied flow
+// forfeits its deficit, so idling does not bank credit.
+template <typename T> class FairQueue
+{
+  private:
+    // var
+    std::vector<RingQueue<T>> m_flows;
+    std::vector<int64_t> m_weights;
+    std::vector<int64_t> m_deficits;
+    size_t m_current;
+    size_t m_size;
+
+  public:
+    // func
+    // weights below 1 count as 1
+    explicit FairQueue(const std::vector<int> &weights);
+    ~FairQueue() = default;
+
+    // flow must be below num_flow()
+    void push(T &&value, size_t flow);
+    // flow receives the flow value came from
+    bool pop(T &value, size_t &flow);
+    // the oldest entry of the longest flow, for shedding load from whoever queued most
+    bool pop_longest(T &value, size_t &flow);
+    size_t size() const;
+    size_t size(size_t flow) const;
+    bool empty() const;
+    size_t num_flow() const;
+};
+
+template <typename T>
+FairQueue<T>::FairQueue(const std::vector<int> &weights)
+    : m_flows(weights.size()), m_deficits(weights.size(), 0), m_current(0), m_size(0)
+{
+    for (int weight : weights)
+    {
+        m_weights.push_back(weight > 0 ? weight : 1);
+    }
+}
+
+template <typename T> void FairQueue<T>::push(T &&value, size_t flow)
+{
+    m_flows[flow].push(std::move(value));
+    m_size++;
+}
+
+template <typename T> bool FairQueue<T>::pop(T &value, size_t &flow)
+{
+    if (m_size == 0)
+    {
+        return false;
+    }
+    while (m_flows[m_current].empty() || m_deficits[m_current] <= 0)
+    {
+        if (m_flows[m_current].empty())
+        {
+            m_deficits[m_current] = 0;
+        }
+        m_current = (m_current + 1) % m_flows.size();
+        if (!m_flows[m_current].empty())
+        {
+            m_deficits[m_current] += m_weights[m_current];
+        }
+    }
+    flow = m_current;
+    value = std::move(m_flows[flow].front());
+    m_flows[flow].pop();
+    m_deficits[flow]--;
+    m_size--;
+    return true;
+}
+
+template <typename T> bool FairQueue<T>::pop_longest(T &value, size_t &flow)
+{
+    if (m_size == 0)
+    {
+        return false;
+    }
+    flow = 0;
+    for (size_t i = 1; i < m_flows.size(); i++)
+    {
+        if (m_flows[i].size() > m_flows[flow].size())
+        {
+            flow = i;
+        }
+    }
+    value = std::move(m_flows[flow].front());
+    m_flows[flow].pop();
+    m_size--;
+    return true;
+}
+
+template <typename T> size_t FairQueue<T>::size() const
+{
+    return m_size;
+}
+
+template <typename T> size_t FairQueue<T>::size(size_t flow) const
+{
+    return m_flows[flow].size();
+}
+
+template <typename T> bool FairQueue<T>::empty() const
+{
+    return m_size == 0;
+}
+
+template <typename T> size_t FairQueue<T>::num_flow() const
+{
+    return m_flows.size();
+}
+
+} // namespace toys
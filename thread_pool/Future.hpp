@@ -0,0 +1,596 @@
+#pragma once
+#include "ThreadPool.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace toys
+{
+
+template <typename T> class Future;
+template <typename T> class Promise;
+
+// the value slot of a future, empty for void
+template <typename T> class ValueHolder
+{
+  private:
+    // var
+    typename std::aligned_storage<sizeof(T), alignof(T)>::type m_storage;
+    bool m_has_value;
+
+  public:
+    // func
+    ValueHolder();
+    ValueHolder(const ValueHolder &) = delete;
+    ValueHolder &operator=(const ValueHolder &) = delete;
+    ~ValueHolder();
+
+    template <typename U> void set(U &&value);
+    T take();
+    template <typename F> auto apply(F &f) -> typename std::result_of<F(T)>::type;
+};
+
+template <> class ValueHolder<void>
+{
+  public:
+    void set()
+    {
+    }
+    void take()
+    {
+    }
+    template <typename F> auto apply(F &f) -> typename std::result_of<F()>::type
+    {
+        return f();
+    }
+};
+
+// state shared by a Promise and its Future. The callback runs once, inline on the thread that makes the
+// state ready, or right away if it is registered after that.
+template <typename T> class FutureState
+{
+  private:
+    // var
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    bool m_ready;
+    ValueHolder<T> m_value;
+    std::exception_ptr m_error;
+    UniqueTask m_callback;
+    // func
+    void mark_ready(std::unique_lock<std::mutex> &lock);
+
+  public:
+    // func
+    FutureState();
+
+    template <typename... V> void set_value(V &&...value);
+    void set_exception(std::exception_ptr error);
+    void on_ready(UniqueTask callback);
+    bool is_ready();
+    void wait();
+    // only after the state is ready
+    std::exception_ptr error();
+    T take();
+    template <typename F> auto apply(F &f) -> decltype(m_value.apply(f));
+};
+
+template <typename T, typename F> struct ContinuationResult
+{
+    using type = typename std::result_of<F(T)>::type;
+};
+
+template <typename F> struct ContinuationResult<void, F>
+{
+    using type = typename std::result_of<F()>::type;
+};
+
+template <typename T> struct WhenAnyResult
+{
+    size_t index;
+    T value;
+};
+
+template <> struct WhenAnyResult<void>
+{
+    size_t index;
+};
+
+template <typename T> class Promise
+{
+  private:
+    // var
+    std::shared_ptr<FutureState<T>> m_state;
+    ThreadPool *m_pool;
+
+  public:
+    // func
+    // continuations of the future are posted to pool, or run inline when pool is null
+    Promise(ThreadPool *pool = nullptr);
+    Promise(Promise &&other) = default;
+    Promise &operator=(Promise &&other) = default;
+    // an unfulfilled promise leaves std::future_errc::broken_promise, e.g. when its task is never run
+    ~Promise();
+
+    Future<T> get_future();
+    template <typename... V> void set_value(V &&...value);
+    void set_exception(std::exception_ptr error);
+};
+
+// Future whose continuations are scheduled on a ThreadPool instead of blocking a thread on get()
+template <typename T> class Future
+{
+  private:
+    // var
+    std::shared_ptr<FutureState<T>> m_state;
+    ThreadPool *m_pool;
+    // func
+    void check_state();
+
+    template <typename U> friend class Future;
+    template <typename U> friend class Promise;
+    template <typename U> friend Future<std::vector<U>> when_all(std::vector<Future<U>> futures);
+    friend Future<void> when_all(std::vector<Future<void>> futures);
+    template <typename U> friend Future<WhenAnyResult<U>> when_any(std::vector<Future<U>> futures);
+
+  public:
+    // func
+    Future();
+    Future(std::shared_ptr<FutureState<T>> state, ThreadPool *pool);
+
+    bool valid();
+    bool is_ready();
+    void wait();
+    T get();
+    // f(value) runs on the pool once the value is ready, an exception skips f and passes on
+    template <typename F> auto then(F &&f) -> Future<typename ContinuationResult<T, F>::type>;
+};
+
+// stores the result of call() in the promise, a void call just makes it ready
+template <typename R> struct FulfilPromise
+{
+    template <typename Call> static void apply(Promise<R> &promise, Call &&call)
+    {
+        promise.set_value(call());
+    }
+};
+
+template <> struct FulfilPromise<void>
+{
+    template <typename Call> static void apply(Promise<void> &promise, Call &&call)
+    {
+        call();
+        promise.set_value();
+    }
+};
+
+template <typename T> ValueHolder<T>::ValueHolder() : m_has_value(false)
+{
+}
+
+template <typename T> ValueHolder<T>::~ValueHolder()
+{
+    if (m_has_value)
+    {
+        reinterpret_cast<T *>(&m_storage)->~T();
+    }
+}
+
+template <typename T> template <typename U> void ValueHolder<T>::set(U &&value)
+{
+    new (&m_storage) T(std::forward<U>(value));
+    m_has_value = true;
+}
+
+template <typename T> T ValueHolder<T>::take()
+{
+    return std::move(*reinterpret_cast<T *>(&m_storage));
+}
+
+template <typename T>
+template <typename F>
+auto ValueHolder<T>::apply(F &f) -> typename std::result_of<F(T)>::type
+{
+    return f(take());
+}
+
+template <typename T> FutureState<T>::FutureState() : m_ready(false)
+{
+}
+
+template <typename T> void FutureState<T>::mark_ready(std::unique_lock<std::mutex> &lock)
+{
+    m_ready = true;
+    UniqueTask callback = std::move(m_callback);
+    lock.unlock();
+    m_condition.notify_all();
+    if (callback)
+    {
+        callback();
+    }
+}
+
+template <typename T> template <typename... V> void FutureState<T>::set_value(V &&...value)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (m_ready)
+    {
+        throw std::future_error(std::future_errc::promise_already_satisfied);
+    }
+    m_value.set(std::forward<V>(value)...);
+    mark_ready(lock);
+}
+
+template <typename T> void FutureState<T>::set_exception(std::exception_ptr error)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (m_ready)
+    {
+        throw std::future_error(std::future_errc::promise_already_satisfied);
+    }
+    m_error = error;
+    mark_ready(lock);
+}
+
+template <typename T> void FutureState<T>::on_ready(UniqueTask callback)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (!m_ready)
+    {
+        m_callback = std::move(callback);
+        return;
+    }
+    lock.unlock();
+    callback();
+}
+
+template <typename T> bool FutureState<T>::is_ready()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_ready;
+}
+
+template <typename T> void FutureState<T>::wait()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_condition.wait(lock, [this]() -> bool { return m_ready; });
+}
+
+template <typename T> std::exception_ptr FutureState<T>::error()
+{
+    return m_error;
+}
+
+template <typename T> T FutureState<T>::take()
+{
+    return m_value.take();
+}
+
+template <typename T> template <typename F> auto FutureState<T>::apply(F &f) -> decltype(m_value.apply(f))
+{
+    return m_value.apply(f);
+}
+
+template <typename T> Promise<T>::Promise(ThreadPool *pool) : m_pool(pool)
+{
+    m_state = std::allocate_shared<FutureState<T>>(SlabAllocator<FutureState<T>>());
+}
+
+template <typename T> Promise<T>::~Promise()
+{
+    if (m_state && !m_state->is_ready())
+    {
+        m_state->set_exception(std::make_exception_ptr(std::future_error(std::future_errc::broken_promise)));
+    }
+}
+
+template <typename T> Future<T> Promise<T>::get_future()
+{
+    return Future<T>(m_state, m_pool);
+}
+
+template <typename T> template <typename... V> void Promise<T>::set_value(V &&...value)
+{
+    m_state->set_value(std::forward<V>(value)...);
+}
+
+template <typename T> void Promise<T>::set_exception(std::exception_ptr error)
+{
+    m_state->set_exception(error);
+}
+
+template <typename T> Future<T>::Future() : m_pool(nullptr)
+{
+}
+
+template <typename T>
+Future<T>::Future(std::shared_ptr<FutureState<T>> state, ThreadPool *pool) : m_state(std::move(state)), m_pool(pool)
+{
+}
+
+template <typename T> void Future<T>::check_state()
+{
+    if (!m_state)
+    {
+        throw std::future_error(std::future_errc::no_state);
+    }
+}
+
+template <typename T> bool Future<T>::valid()
+{
+    return m_state != nullptr;
+}
+
+template <typename T> bool Future<T>::is_ready()
+{
+    check_state();
+    return m_state->is_ready();
+}
+
+template <typename T> void Future<T>::wait()
+{
+    check_state();
+    m_state->wait();
+}
+
+template <typename T> T Future<T>::get()
+{
+    check_state();
+    std::shared_ptr<FutureState<T>> state = std::move(m_state);
+    state->wait();
+    if (state->error())
+    {
+        std::rethrow_exception(state->error());
+    }
+    return state->take();
+}
+
+template <typename T, typename R, typename Func> struct ContinuationTask
+{
+    std::shared_ptr<FutureState<T>> state;
+    Promise<R> promise;
+    Func func;
+
+    void operator()()
+    {
+        if (state->error())
+        {
+            promise.set_exception(state->error());
+            return;
+        }
+        try
+        {
+            FulfilPromise<R>::apply(promise, [this]() { return state->apply(func); });
+        }
+        catch (...)
+        {
+            promise.set_exception(std::current_exception());
+        }
+    }
+};
+
+// the on_ready callback of a continuation with a pool, it only hops onto the pool
+template <typename Task> struct PostTask
+{
+    ThreadPool *pool;
+    Task task;
+
+    void operator()()
+    {
+        pool->post(std::move(task));
+    }
+};
+
+template <typename T>
+template <typename F>
+auto Future<T>::then(F &&f) -> Future<typename ContinuationResult<T, F>::type>
+{
+    using R = typename ContinuationResult<T, F>::type;
+    using Task = ContinuationTask<T, R, typename std::decay<F>::type>;
+    check_state();
+    Promise<R> promise(m_pool);
+    Future<R> result = promise.get_future();
+    ThreadPool *pool = m_pool;
+    Task task{std::move(m_state), std::move(promise), std::forward<F>(f)};
+    std::shared_ptr<FutureState<T>> state = task.state;
+    if (pool == nullptr)
+    {
+        state->on_ready(UniqueTask(std::move(task)));
+    }
+    else
+    {
+        // the callback only hops onto the pool, f itself never runs on the completing thread
+        state->on_ready(UniqueTask(PostTask<Task>{pool, std::move(task)}));
+    }
+    return result;
+}
+
+template <typename R, typename Func> struct AsyncTask
+{
+    Promise<R> promise;
+    Func func;
+
+    void operator()()
+    {
+        try
+        {
+            FulfilPromise<R>::apply(promise, func);
+        }
+        catch (...)
+        {
+            promise.set_exception(std::current_exception());
+        }
+    }
+};
+
+// like ThreadPool::add, but returns a Future that supports then/when_all/when_any
+template <typename F, typename... Args>
+auto async(ThreadPool &pool, F &&f, Args &&...args) -> Future<typename std::result_of<F(Args...)>::type>
+{
+    using R = typename std::result_of<F(Args...)>::type;
+    using Func = decltype(std::bind(std::forward<F>(f), std::forward<Args>(args)...));
+    Promise<R> promise(&pool);
+    Future<R> result = promise.get_future();
+    pool.post(AsyncTask<R, Func>{std::move(promise), std::bind(std::forward<F>(f), std::forward<Args>(args)...)});
+    return result;
+}
+
+// ready when every input is ready, values in input order; the first exception wins
+template <typename T> Future<std::vector<T>> when_all(std::vector<Future<T>> futures)
+{
+    struct WhenAllState
+    {
+        std::vector<ValueHolder<T>> values;
+        std::atomic<size_t> remaining;
+        std::atomic<bool> failed;
+        Promise<std::vector<T>> promise;
+
+        WhenAllState(size_t size, ThreadPool *pool) : values(size), remaining(size), failed(false), promise(pool)
+        {
+        }
+    };
+    ThreadPool *pool = futures.empty() ? nullptr : futures[0].m_pool;
+    std::shared_ptr<WhenAllState> all = std::make_shared<WhenAllState>(futures.size(), pool);
+    Future<std::vector<T>> result = all->promise.get_future();
+    if (futures.empty())
+    {
+        all->promise.set_value(std::vector<T>());
+        return result;
+    }
+    for (size_t i = 0; i < futures.size(); i++)
+    {
+        futures[i].check_state();
+        std::shared_ptr<FutureState<T>> state = std::move(futures[i].m_state);
+        FutureState<T> *state_ptr = state.get();
+        state_ptr->on_ready(UniqueTask([all, state, i]() {
+            if (state->error())
+            {
+                if (!all->failed.exchange(true))
+                {
+                    all->promise.set_exception(state->error());
+                }
+            }
+            else
+            {
+                all->values[i].set(state->take());
+            }
+            if (all->remaining.fetch_sub(1) == 1 && !all->failed.load())
+            {
+                std::vector<T> values;
+                values.reserve(all->values.size());
+                for (ValueHolder<T> &value : all->values)
+                {
+                    values.push_back(value.take());
+                }
+                all->promise.set_value(std::move(values));
+            }
+        }));
+    }
+    return result;
+}
+
+Future<void> when_all(std::vector<Future<void>> futures)
+{
+    struct WhenAllState
+    {
+        std::atomic<size_t> remaining;
+        std::atomic<bool> failed;
+        Promise<void> promise;
+
+        WhenAllState(size_t size, ThreadPool *pool) : remaining(size), failed(false), promise(pool)
+        {
+        }
+    };
+    ThreadPool *pool = futures.empty() ? nullptr : futures[0].m_pool;
+    std::shared_ptr<WhenAllState> all = std::make_shared<WhenAllState>(futures.size(), pool);
+    Future<void> result = all->promise.get_future();
+    if (futures.empty())
+    {
+        all->promise.set_value();
+        return result;
+    }
+    for (Future<void> &future : futures)
+    {
+        future.check_state();
+        std::shared_ptr<FutureState<void>> state = std::move(future.m_state);
+        FutureState<void> *state_ptr = state.get();
+        state_ptr->on_ready(UniqueTask([all, state]() {
+            if (state->error() && !all->failed.exchange(true))
+            {
+                all->promise.set_exception(state->error());
+            }
+            if (all->remaining.fetch_sub(1) == 1 && !all->failed.load())
+            {
+                all->promise.set_value();
+            }
+        }));
+    }
+    return result;
+}
+
+template <typename T> struct WhenAnyFulfil
+{
+    static void apply(Promise<WhenAnyResult<T>> &promise, FutureState<T> &state, size_t index)
+    {
+        promise.set_value(WhenAnyResult<T>{index, state.take()});
+    }
+};
+
+template <> struct WhenAnyFulfil<void>
+{
+    static void apply(Promise<WhenAnyResult<void>> &promise, FutureState<void> &, size_t index)
+    {
+        promise.set_value(WhenAnyResult<void>{index});
+    }
+};
+
+// ready with the index (and value) of the first input to become ready, or with its exception
+template <typename T> Future<WhenAnyResult<T>> when_any(std::vector<Future<T>> futures)
+{
+    struct WhenAnyState
+    {
+        std::atomic<bool> done;
+        Promise<WhenAnyResult<T>> promise;
+
+        WhenAnyState(ThreadPool *pool) : done(false), promise(pool)
+        {
+        }
+    };
+    if (futures.empty())
+    {
+        throw std::future_error(std::future_errc::no_state);
+    }
+    std::shared_ptr<WhenAnyState> any = std::make_shared<WhenAnyState>(futures[0].m_pool);
+    Future<WhenAnyResult<T>> result = any->promise.get_future();
+    for (size_t i = 0; i < futures.size(); i++)
+    {
+        futures[i].check_state();
+        std::shared_ptr<FutureState<T>> state = std::move(futures[i].m_state);
+        FutureState<T> *state_ptr = state.get();
+        state_ptr->on_ready(UniqueTask([any, state, i]() {
+            if (any->done.exchange(true))
+            {
+                return;
+            }
+            if (state->error())
+            {
+                any->promise.set_exception(state->error());
+            }
+            else
+            {
+                WhenAnyFulfil<T>::apply(any->promise, *state, i);
+            }
+        }));
+    }
+    return result;
+}
+
+} // namespace toys
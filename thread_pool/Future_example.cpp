@@ -0,0 +1,41 @@
+#include "Future.hpp"
+#include <iostream>
+#include <string>
+#include <vector>
+
+int square(int x)
+{
+    return x * x;
+}
+
+int main(int argc, char **argv)
+{
+    toys::ThreadPool tp(3);
+
+    toys::Future<std::string> f1 =
+        toys::async(tp, &square, 7).then([](int x) { return x + 1; }).then([](int x) { return std::to_string(x); });
+    std::cout << f1.get() << std::endl;
+
+    std::vector<toys::Future<int>> parts;
+    for (int i = 1; i <= 4; i++)
+    {
+        parts.push_back(toys::async(tp, &square, i));
+    }
+    toys::Future<int> total = toys::when_all(std::move(parts)).then([](std::vector<int> values) {
+        int sum = 0;
+        for (int v : values)
+        {
+            sum += v;
+        }
+        return sum;
+    });
+    std::cout << total.get() << std::endl;
+
+    std::vector<toys::Future<int>> racers;
+    racers.push_back(toys::async(tp, &square, 5));
+    racers.push_back(toys::async(tp, &square, 6));
+    toys::WhenAnyResult<int> first = toys::when_any(std::move(racers)).get();
+    std::cout << first.index << " " << first.value << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,141 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace toys
+{
+
+// Log-linear histogram in the spirit of HdrHistogram: values below 2^SUB_BITS get exact buckets, larger ones
+// keep SUB_BITS bits below the leading one, so a bucket is never wider than 1/2^SUB_BITS of its values.
+// record() is for a single writer, a relaxed load and store with no read-modify-write; record_shared() takes any
+// number of writers. Any number of readers either way.
+class Histogram
+{
+  public:
+    static constexpr int SUB_BITS = 3;                                     // 8 buckets per power of two
+    static constexpr size_t NUM_BUCKET = (64 - SUB_BITS + 1) << SUB_BITS; // every uint64_t value
+
+  private:
+    // var
+    std::atomic<uint64_t> m_counts[NUM_BUCKET];
+
+  public:
+    // func
+    Histogram();
+    Histogram(const Histogram &) = delete;
+    Histogram &operator=(const Histogram &) = delete;
+    ~Histogram() = default;
+
+    void record(uint64_t value);
+    void record_shared(uint64_t value);
+    uint64_t count(size_t bucket) const;
+    static size_t bucket_of(uint64_t value);
+    static uint64_t bucket_lower(size_t bucket);
+};
+
+// plain copy of one or more histograms, for percentiles
+class HistogramSnapshot
+{
+  private:
+    // var
+    std::vector<uint64_t> m_counts;
+    uint64_t m_total;
+
+  public:
+    // func
+    HistogramSnapshot();
+
+    void merge(const Histogram &histogram);
+    uint64_t count() const;
+    // upper bound of the bucket holding the p-th percentile, p in [0, 100]; 0 when empty
+    uint64_t percentile(double p) const;
+};
+
+Histogram::Histogram()
+{
+    for (std::atomic<uint64_t> &count : m_counts)
+    {
+        count.store(0, std::memory_order_relaxed);
+    }
+}
+
+size_t Histogram::bucket_of(uint64_t value)
+{
+    if (value < (1u << SUB_BITS))
+    {
+        return static_cast<size_t>(value);
+    }
+    int exponent = 63 - __builtin_clzll(value);
+    size_t mantissa = (value >> (exponent - SUB_BITS)) & ((1u << SUB_BITS) - 1);
+    return (static_cast<size_t>(exponent - SUB_BITS + 1) << SUB_BITS) + mantissa;
+}
+
+uint64_t Histogram::bucket_lower(size_t bucket)
+{
+    if (bucket < (1u << SUB_BITS))
+    {
+        return bucket;
+    }
+    size_t group = bucket >> SUB_BITS;
+    uint64_t mantissa = bucket & ((1u << SUB_BITS) - 1);
+    return ((1ULL << SUB_BITS) + mantissa) << (group - 1);
+}
+
+void Histogram::record(uint64_t value)
+{
+    std::atomic<uint64_t> &count = m_counts[bucket_of(value)];
+    count.store(count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+void Histogram::record_shared(uint64_t value)
+{
+    m_counts[bucket_of(value)].fetch_add(1, std::memory_order_relaxed);
+}
+
+uint64_t Histogram::count(size_t bucket) const
+{
+    return m_counts[bucket].load(std::memory_order_relaxed);
+}
+
+HistogramSnapshot::HistogramSnapshot() : m_counts(static_cast<size_t>(Histogram::NUM_BUCKET), 0), m_total(0)
+{
+}
+
+void HistogramSnapshot::merge(const Histogram &histogram)
+{
+    for (size_t i = 0; i < Histogram::NUM_BUCKET; i++)
+    {
+        uint64_t count = histogram.count(i);
+        m_counts[i] += count;
+        m_total += count;
+    }
+}
+
+uint64_t HistogramSnapshot::count() const
+{
+    return m_total;
+}
+
+uint64_t HistogramSnapshot::percentile(double p) const
+{
+    if (m_total == 0)
+    {
+        return 0;
+    }
+    uint64_t rank = static_cast<uint64_t>(p / 100 * m_total);
+    rank = rank < 1 ? 1 : (rank > m_total ? m_total : rank);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < Histogram::NUM_BUCKET; i++)
+    {
+        seen += m_counts[i];
+        if (seen >= rank)
+        {
+            return i + 1 < Histogram::NUM_BUCKET ? Histogram::bucket_lower(i + 1) - 1 : UINT64_MAX;
+        }
+    }
+    return UINT64_MAX;
+}
+
+} // namespace toys
@@ -0,0 +1,128 @@
+/*
+reference:
+https://www.1024cores.net/home/lock-free-algorithms/queues/bounded-mpmc-queue
+*/
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+namespace toys
+{
+
+// Bounded lock-free multi-producer multi-consumer queue. Every cell carries a sequence number telling
+// producers and consumers whose turn it is, so the only shared writes are one CAS per operation.
+template <typename T> class MPMCQueue
+{
+  private:
+    struct Cell
+    {
+        std::atomic<size_t> sequence;
+        T data;
+    };
+
+    // var
+    std::unique_ptr<Cell[]> m_cells;
+    size_t m_mask;
+    char m_cells_pad[64 - sizeof(std::unique_ptr<Cell[]>) - sizeof(size_t)];
+    std::atomic<size_t> m_enqueue_pos;
+    char m_enqueue_pad[64 - sizeof(std::atomic<size_t>)];
+    std::atomic<size_t> m_dequeue_pos;
+    char m_dequeue_pad[64 - sizeof(std::atomic<size_t>)];
+
+  public:
+    // func
+    MPMCQueue(size_t capacity);
+    MPMCQueue(const MPMCQueue &) = delete;
+    MPMCQueue &operator=(const MPMCQueue &) = delete;
+    ~MPMCQueue() = default;
+
+    // value is only moved from when the push succeeds
+    bool try_push(T &&value);
+    bool try_pop(T &value);
+    size_t capacity() const;
+};
+
+template <typename T> MPMCQueue<T>::MPMCQueue(size_t capacity) : m_enqueue_pos(0), m_dequeue_pos(0)
+{
+    size_t real_capacity = 2;
+    while (real_capacity < capacity)
+    {
+        real_capacity <<= 1;
+    }
+    m_cells.reset(new Cell[real_capacity]);
+    m_mask = real_capacity - 1;
+    for (size_t i = 0; i < real_capacity; i++)
+    {
+        m_cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+}
+
+template <typename T> bool MPMCQueue<T>::try_push(T &&value)
+{
+    size_t pos = m_enqueue_pos.load(std::memory_order_relaxed);
+    Cell *cell;
+    while (true)
+    {
+        cell = &m_cells[pos & m_mask];
+        size_t sequence = cell->sequence.load(std::memory_order_acquire);
+        intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+        if (diff == 0)
+        {
+            if (m_enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if (diff < 0)
+        {
+            return false; // full
+        }
+        else
+        {
+            pos = m_enqueue_pos.load(std::memory_order_relaxed);
+        }
+    }
+    cell->data = std::move(value);
+    cell->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+}
+
+template <typename T> bool MPMCQueue<T>::try_pop(T &value)
+{
+    size_t pos = m_dequeue_pos.load(std::memory_order_relaxed);
+    Cell *cell;
+    while (true)
+    {
+        cell = &m_cells[pos & m_mask];
+        size_t sequence = cell->sequence.load(std::memory_order_acquire);
+        intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos + 1);
+        if (diff == 0)
+        {
+            if (m_dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if (diff < 0)
+        {
+            return false; // empty
+        }
+        else
+        {
+            pos = m_dequeue_pos.load(std::memory_order_relaxed);
+        }
+    }
+    value = std::move(cell->data);
+    cell->sequence.store(pos + m_mask + 1, std::memory_order_release);
+    return true;
+}
+
+template <typename T> size_t MPMCQueue<T>::capacity() const
+{
+    return m_mask + 1;
+}
+
+} // namespace toys
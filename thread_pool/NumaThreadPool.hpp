@@ -0,0 +1,222 @@
+#pragma once
+#include "ThreadPool.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <fstream>
+#include <future>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#if defined(__linux__)
+#include <dirent.h>
+#include <sched.h>
+#endif
+
+namespace toys
+{
+
+struct NumaNode
+{
+    int id; // as in /sys/devices/system/node/node<id>
+    std::vector<int> cpus;
+};
+
+// "0-3,8,10-11" -> {0, 1, 2, 3, 8, 10, 11}
+std::vector<int> parse_cpu_list(const std::string &list)
+{
+    std::vector<int> cpus;
+    size_t pos = 0;
+    while (pos < list.size())
+    {
+        size_t end = list.find(',', pos);
+        if (end == std::string::npos)
+        {
+            end = list.size();
+        }
+        std::string range = list.substr(pos, end - pos);
+        size_t dash = range.find('-');
+        if (!range.empty() && range[0] >= '0' && range[0] <= '9')
+        {
+            int first = std::atoi(range.c_str());
+            int last = dash == std::string::npos ? first : std::atoi(range.c_str() + dash + 1);
+            for (int cpu = first; cpu <= last; cpu++)
+            {
+                cpus.push_back(cpu);
+            }
+        }
+        pos = end + 1;
+    }
+    return cpus;
+}
+
+// NUMA nodes that have cpus the process may run on, sorted by id. Without sysfs (or off Linux) the whole
+// machine is reported as node 0.
+std::vector<NumaNode> numa_nodes()
+{
+    std::vector<NumaNode> nodes;
+#if defined(__linux__)
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    bool has_allowed = sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+    if (DIR *dir = opendir("/sys/devices/system/node"))
+    {
+        while (dirent *entry = readdir(dir))
+        {
+            std::string name = entry->d_name;
+            if (name.compare(0, 4, "node") != 0 || name.size() == 4 || name[4] < '0' || name[4] > '9')
+            {
+                continue;
+            }
+            std::ifstream file("/sys/devices/system/node/" + name + "/cpulist");
+            std::string list;
+            std::getline(file, list);
+            NumaNode node{std::atoi(name.c_str() + 4), {}};
+            for (int cpu : parse_cpu_list(list))
+            {
+                if (!has_allowed || (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed)))
+                {
+                    node.cpus.push_back(cpu);
+                }
+            }
+            // memory-only nodes have no cpus to run workers on
+            if (!node.cpus.empty())
+            {
+                nodes.push_back(node);
+            }
+        }
+        closedir(dir);
+    }
+    std::sort(nodes.begin(), nodes.end(), [](const NumaNode &a, const NumaNode &b) { return a.id < b.id; });
+    if (nodes.empty() && has_allowed)
+    {
+        NumaNode node{0, {}};
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+        {
+            if (CPU_ISSET(cpu, &allowed))
+            {
+                node.cpus.push_back(cpu);
+            }
+        }
+        nodes.push_back(node);
+    }
+#endif
+    if (nodes.empty())
+    {
+        NumaNode node{0, {}};
+        for (unsigned cpu = 0; cpu < std::max(1u, std::thread::hardware_concurrency()); cpu++)
+        {
+            node.cpus.push_back(cpu);
+        }
+        nodes.push_back(node);
+    }
+    return nodes;
+}
+
+// One ThreadPool per NUMA node, each worker pinned to a cpu of its node, so a task submitted with a node
+// hint runs on the socket whose memory holds its data.
+class NumaThreadPool
+{
+  private:
+    // var
+    std::vector<NumaNode> m_nodes;
+    std::vector<std::unique_ptr<ThreadPool>> m_pools;
+    std::vector<int> m_node_index; // node id -> index in m_nodes, -1 for unknown ids
+    std::atomic<size_t> m_next;    // round robin for tasks without a usable hint
+    // func
+    ThreadPool &select(int node);
+
+  public:
+    // func
+    // workers_per_node <= 0 starts one worker per cpu of each node; options.cpus is replaced by the node's cpus
+    NumaThreadPool(int workers_per_node = 0, const ThreadPoolOptions &options = ThreadPoolOptions());
+    NumaThreadPool(const NumaThreadPool &) = delete;
+    NumaThreadPool &operator=(const NumaThreadPool &) = delete;
+    ~NumaThreadPool() = default;
+
+    // node is a NumaNode::id, a negative or unknown one spreads tasks round robin over all nodes
+    template <typename F, typename... Args>
+    auto add(int node, F &&f, Args &&...args) -> std::future<typename std::result_of<F(Args...)>::type>;
+    template <typename F> void post(int node, F &&f);
+    const std::vector<NumaNode> &nodes();
+    ThreadPool &pool(int node);
+    // node of the cpu the calling thread runs on, -1 if unknown
+    int current_node();
+    size_t size();
+};
+
+NumaThreadPool::NumaThreadPool(int workers_per_node, const ThreadPoolOptions &options)
+    : m_nodes(numa_nodes()), m_next(0)
+{
+    for (size_t i = 0; i < m_nodes.size(); i++)
+    {
+        const NumaNode &node = m_nodes[i];
+        if (static_cast<size_t>(node.id) >= m_node_index.size())
+        {
+            m_node_index.resize(node.id + 1, -1);
+        }
+        m_node_index[node.id] = static_cast<int>(i);
+        ThreadPoolOptions node_options = options;
+        node_options.cpus = node.cpus;
+        int num_worker = workers_per_node > 0 ? workers_per_node : static_cast<int>(node.cpus.size());
+        m_pools.emplace_back(new ThreadPool(num_worker, node_options));
+    }
+}
+
+ThreadPool &NumaThreadPool::select(int node)
+{
+    if (node >= 0 && static_cast<size_t>(node) < m_node_index.size() && m_node_index[node] >= 0)
+    {
+        return *m_pools[m_node_index[node]];
+    }
+    return *m_pools[m_next.fetch_add(1, std::memory_order_relaxed) % m_pools.size()];
+}
+
+template <typename F, typename... Args>
+auto NumaThreadPool::add(int node, F &&f, Args &&...args) -> std::future<typename std::result_of<F(Args...)>::type>
+{
+    return select(node).add(std::forward<F>(f), std::forward<Args>(args)...);
+}
+
+template <typename F> void NumaThreadPool::post(int node, F &&f)
+{
+    select(node).post(std::forward<F>(f));
+}
+
+const std::vector<NumaNode> &NumaThreadPool::nodes()
+{
+    return m_nodes;
+}
+
+ThreadPool &NumaThreadPool::pool(int node)
+{
+    return select(node);
+}
+
+int NumaThreadPool::current_node()
+{
+#if defined(__linux__)
+    int cpu = sched_getcpu();
+    for (const NumaNode &node : m_nodes)
+    {
+        if (std::find(node.cpus.begin(), node.cpus.end(), cpu) != node.cpus.end())
+        {
+            return node.id;
+        }
+    }
+#endif
+    return -1;
+}
+
+size_t NumaThreadPool::size()
+{
+    size_t num_worker = 0;
+    for (std::unique_ptr<ThreadPool> &pool : m_pools)
+    {
+        num_worker += pool->size();
+    }
+    return num_worker;
+}
+
+} // namespace toys
@@ -0,0 +1,35 @@
+#include "NumaThreadPool.hpp"
+#include <iostream>
+#include <numeric>
+#include <vector>
+
+int main(int argc, char **argv)
+{
+    for (const toys::NumaNode &node : toys::numa_nodes())
+    {
+        std::cout << "node " << node.id << ": " << node.cpus.size() << " cpus" << std::endl;
+    }
+
+    // one sub-pool per node, workers pinned to the node's cpus
+    toys::NumaThreadPool numa;
+    std::cout << numa.size() << " workers" << std::endl;
+    for (const toys::NumaNode &node : numa.nodes())
+    {
+        // data first touched on a node lives in that node's memory, keep the work on the same node
+        auto sum = numa.add(node.id, [&numa]() {
+            std::vector<int> data(1 << 20, 1);
+            std::cout << "running on node " << numa.current_node() << std::endl;
+            return std::accumulate(data.begin(), data.end(), 0);
+        });
+        int total = sum.get();
+        std::cout << "sum " << total << std::endl;
+    }
+
+    // plain pool with every worker pinned to cpu 0
+    toys::ThreadPoolOptions options;
+    options.cpus = {0};
+    toys::ThreadPool pinned(2, options);
+    pinned.add([]() { std::cout << "pinned worker on cpu " << sched_getcpu() << std::endl; }).wait();
+
+    return 0;
+}
@@ -0,0 +1,511 @@
+/*
+reference:
+https://www.cs.cmu.edu/~guyb/papers/lbs.pdf (Lazy Binary Splitting)
+https://github.com/oneapi-src/oneTBB (partitioners)
+*/
+#pragma once
+#include "ThreadPool.hpp"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+#include <vector>
+
+namespace toys
+{
+
+enum Partitioner
+{
+    SIMPLE_PARTITIONER,   // split recursively down to the grain size up front
+    ADAPTIVE_PARTITIONER, // lazy binary splitting, only split while the pool is short of queued work
+};
+
+// Shared by every piece of one parallel loop. RangeBody is called as body(begin, end) on offsets.
+template <typename RangeBody> class ParallelForState
+{
+  private:
+    struct Piece
+    {
+        std::atomic<bool> claimed;
+        size_t begin;
+        size_t end;
+
+        Piece(size_t begin, size_t end) : claimed(false), begin(begin), end(end)
+        {
+        }
+    };
+    // a split-off piece runs at most once, either on a worker or back on the thread that split it
+    struct PieceTask
+    {
+        std::shared_ptr<ParallelForState> state;
+        std::shared_ptr<Piece> piece;
+
+        void operator()()
+        {
+            if (!piece->claimed.exchange(true))
+            {
+                state->run(state, piece->begin, piece->end);
+            }
+        }
+    };
+    static constexpr size_t MAX_PIECES = 64; // every split halves the range
+
+    // var
+    ThreadPool &m_pool;
+    RangeBody &m_body;
+    size_t m_grain;
+    Partitioner m_partitioner;
+    std::atomic<size_t> m_remaining;
+    std::atomic<bool> m_failed;
+    std::exception_ptr m_error;
+    bool m_done;
+    std::mutex m_done_mutex;
+    std::condition_variable m_done_condition;
+    // func
+    bool should_split();
+    void execute(size_t begin, size_t end);
+
+  public:
+    // func
+    ParallelForState(ThreadPool &pool, RangeBody &body, size_t size, size_t grain, Partitioner partitioner);
+    static void run(const std::shared_ptr<ParallelForState> &state, size_t begin, size_t end);
+    void wait();
+};
+
+template <typename RangeBody>
+ParallelForState<RangeBody>::ParallelForState(ThreadPool &pool, RangeBody &body, size_t size, size_t grain,
+                                              Partitioner partitioner)
+    : m_pool(pool), m_body(body), m_grain(grain), m_partitioner(partitioner), m_remaining(size), m_failed(false),
+      m_done(size == 0)
+{
+}
+
+template <typename RangeBody> bool ParallelForState<RangeBody>::should_split()
+{
+    if (m_partitioner == SIMPLE_PARTITIONER)
+    {
+        return true;
+    }
+    return m_pool.num_pending() < static_cast<int64_t>(m_pool.size());
+}
+
+template <typename RangeBody> void ParallelForState<RangeBody>::execute(size_t begin, size_t end)
+{
+    if (!m_failed.load(std::memory_order_relaxed))
+    {
+        try
+        {
+            m_body(begin, end);
+        }
+        catch (...)
+        {
+            // keep the first exception and skip the rest of the loop
+            if (!m_failed.exchange(true))
+            {
+                m_error = std::current_exception();
+            }
+        }
+    }
+    if (m_remaining.fetch_sub(end - begin) == end - begin)
+    {
+        std::lock_guard<std::mutex> lock(m_done_mutex);
+        m_done = true;
+        m_done_condition.notify_all();
+    }
+}
+
+template <typename RangeBody>
+void ParallelForState<RangeBody>::run(const std::shared_ptr<ParallelForState> &state, size_t begin, size_t end)
+{
+    std::shared_ptr<Piece> pieces[MAX_PIECES];
+    size_t num_piece = 0;
+    while (end - begin > state->m_grain)
+    {
+        if (num_piece < MAX_PIECES && state->should_split())
+        {
+            size_t mid = begin + (end - begin) / 2;
+            pieces[num_piece] = std::allocate_shared<Piece>(SlabAllocator<Piece>(), mid, end);
+            state->m_pool.post(PieceTask{state, pieces[num_piece]});
+            num_piece++;
+            end = mid;
+        }
+        else
+        {
+            state->execute(begin, begin + state->m_grain);
+            begin += state->m_grain;
+        }
+    }
+    state->execute(begin, end);
+    // take back whatever no worker has started, so the caller never waits on a queued task
+    while (num_piece > 0)
+    {
+        num_piece--;
+        if (!pieces[num_piece]->claimed.exchange(true))
+        {
+            run(state, pieces[num_piece]->begin, pieces[num_piece]->end);
+        }
+    }
+}
+
+template <typename RangeBody> void ParallelForState<RangeBody>::wait()
+{
+    {
+        std::unique_lock<std::mutex> lock(m_done_mutex);
+        m_done_condition.wait(lock, [this]() -> bool { return m_done; });
+    }
+    if (m_error)
+    {
+        std::rethrow_exception(m_error);
+    }
+}
+
+// body(begin, end) over offsets in [0, size). The calling thread works on the range too and returns once
+// every offset is processed. grain 0 picks about 8 chunks per worker.
+template <typename RangeBody>
+void parallel_for_range(ThreadPool &pool, size_t size, RangeBody &&body, size_t grain = 0,
+                        Partitioner partitioner = ADAPTIVE_PARTITIONER)
+{
+    if (size == 0)
+    {
+        return;
+    }
+    if (grain == 0)
+    {
+        grain = std::max<size_t>(1, size / (8 * std::max<size_t>(1, pool.size())));
+    }
+    using State = ParallelForState<typename std::remove_reference<RangeBody>::type>;
+    std::shared_ptr<State> state = std::make_shared<State>(pool, body, size, grain, partitioner);
+    State::run(state, 0, size);
+    state->wait();
+}
+
+template <typename Index, typename Body>
+void parallel_for(ThreadPool &pool, Index first, Index last, Body &&body, size_t grain = 0,
+                  Partitioner partitioner = ADAPTIVE_PARTITIONER)
+{
+    static_assert(std::is_integral<Index>::value, "parallel_for needs an integral index");
+    if (!(first < last))
+    {
+        return;
+    }
+    parallel_for_range(
+        pool, static_cast<size_t>(last - first),
+        [first, &body](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++)
+            {
+                body(static_cast<Index>(first + i));
+            }
+        },
+        grain, partitioner);
+}
+
+template <typename RandomIt, typename Func>
+void parallel_for_each(ThreadPool &pool, RandomIt first, RandomIt last, Func &&func, size_t grain = 0,
+                       Partitioner partitioner = ADAPTIVE_PARTITIONER)
+{
+    static_assert(std::is_base_of<std::random_access_iterator_tag,
+                                  typename std::iterator_traits<RandomIt>::iterator_category>::value,
+                  "parallel_for_each needs random access iterators");
+    parallel_for_range(
+        pool, static_cast<size_t>(std::distance(first, last)),
+        [first, &func](size_t begin, size_t end) {
+            for (RandomIt it = first + begin; it != first + end; ++it)
+            {
+                func(*it);
+            }
+        },
+        grain, partitioner);
+}
+
+// Reductions and scans cut the input into a fixed set of blocks, so the combine order and therefore the
+// result does not depend on scheduling. op only needs to be associative.
+size_t parallel_num_block(ThreadPool &pool, size_t size)
+{
+    const size_t min_block_size = 1024;
+    size_t num_block = std::min(size / min_block_size, 4 * std::max<size_t>(1, pool.size()));
+    return std::max<size_t>(1, num_block);
+}
+
+size_t parallel_block_begin(size_t size, size_t num_block, size_t block)
+{
+    return size / num_block * block + std::min(block, size % num_block);
+}
+
+template <typename RandomIt, typename T, typename BinaryOp, typename UnaryOp>
+T parallel_transform_reduce(ThreadPool &pool, RandomIt first, RandomIt last, T init, BinaryOp reduce,
+                            UnaryOp transform)
+{
+    size_t size = static_cast<size_t>(std::distance(first, last));
+    if (size == 0)
+    {
+        return init;
+    }
+    size_t num_block = parallel_num_block(pool, size);
+    std::vector<T> partials(num_block, init);
+    parallel_for_range(
+        pool, num_block,
+        [&](size_t block_begin, size_t block_end) {
+            for (size_t block = block_begin; block < block_end; block++)
+            {
+                RandomIt it = first + parallel_block_begin(size, num_block, block);
+                RandomIt end = first + parallel_block_begin(size, num_block, block + 1);
+                T acc = transform(*it);
+                for (++it; it != end; ++it)
+                {
+                    acc = reduce(std::move(acc), transform(*it));
+                }
+                partials[block] = std::move(acc);
+            }
+        },
+        1);
+    T result = std::move(init);
+    for (T &partial : partials)
+    {
+        result = reduce(std::move(result), std::move(partial));
+    }
+    return result;
+}
+
+template <typename RandomIt, typename T, typename BinaryOp>
+T parallel_reduce(ThreadPool &pool, RandomIt first, RandomIt last, T init, BinaryOp reduce)
+{
+    using Value = typename std::iterator_traits<RandomIt>::value_type;
+    return parallel_transform_reduce(pool, first, last, std::move(init), reduce,
+                                     [](const Value &value) -> const Value & { return value; });
+}
+
+template <typename RandomIt, typename T>
+T parallel_reduce(ThreadPool &pool, RandomIt first, RandomIt last, T init)
+{
+    return parallel_reduce(pool, first, last, std::move(init), std::plus<T>());
+}
+
+// Two passes: block sums in parallel, a serial scan over the block sums, then each block is scanned in
+// parallel from its offset. d_first may equal first.
+template <typename RandomIt, typename OutputIt, typename BinaryOp>
+OutputIt parallel_inclusive_scan(ThreadPool &pool, RandomIt first, RandomIt last, OutputIt d_first, BinaryOp op)
+{
+    using Value = typename std::iterator_traits<RandomIt>::value_type;
+    size_t size = static_cast<size_t>(std::distance(first, last));
+    if (size == 0)
+    {
+        return d_first;
+    }
+    size_t num_block = parallel_num_block(pool, size);
+    std::vector<Value> offsets(num_block, *first);
+    parallel_for_range(
+        pool, num_block - 1,
+        [&](size_t block_begin, size_t block_end) {
+            for (size_t block = block_begin; block < block_end; block++)
+            {
+                RandomIt it = first + parallel_block_begin(size, num_block, block);
+                RandomIt end = first + parallel_block_begin(size, num_block, block + 1);
+                Value acc = *it;
+                for (++it; it != end; ++it)
+                {
+                    acc = op(std::move(acc), *it);
+                }
+                offsets[block + 1] = std::move(acc);
+            }
+        },
+        1);
+    for (size_t block = 2; block < num_block; block++)
+    {
+        offsets[block] = op(offsets[block - 1], offsets[block]);
+    }
+    parallel_for_range(
+        pool, num_block,
+        [&](size_t block_begin, size_t block_end) {
+            for (size_t block = block_begin; block < block_end; block++)
+            {
+                size_t begin = parallel_block_begin(size, num_block, block);
+                size_t end = parallel_block_begin(size, num_block, block + 1);
+                Value acc = block == 0 ? Value(first[begin]) : op(offsets[block], first[begin]);
+                d_first[begin] = acc;
+                for (size_t i = begin + 1; i < end; i++)
+                {
+                    acc = op(std::move(acc), first[i]);
+                    d_first[i] = acc;
+                }
+            }
+        },
+        1);
+    return d_first + size;
+}
+
+template <typename RandomIt, typename OutputIt>
+OutputIt parallel_inclusive_scan(ThreadPool &pool, RandomIt first, RandomIt last, OutputIt d_first)
+{
+    using Value = typename std::iterator_traits<RandomIt>::value_type;
+    return parallel_inclusive_scan(pool, first, last, d_first, std::plus<Value>());
+}
+
+template <typename RandomIt, typename OutputIt, typename T, typename BinaryOp>
+OutputIt parallel_exclusive_scan(ThreadPool &pool, RandomIt first, RandomIt last, OutputIt d_first, T init,
+                                 BinaryOp op)
+{
+    size_t size = static_cast<size_t>(std::distance(first, last));
+    if (size == 0)
+    {
+        return d_first;
+    }
+    size_t num_block = parallel_num_block(pool, size);
+    std::vector<T> offsets(num_block, init);
+    parallel_for_range(
+        pool, num_block - 1,
+        [&](size_t block_begin, size_t block_end) {
+            for (size_t block = block_begin; block < block_end; block++)
+            {
+                RandomIt it = first + parallel_block_begin(size, num_block, block);
+                RandomIt end = first + parallel_block_begin(size, num_block, block + 1);
+                T acc = *it;
+                for (++it; it != end; ++it)
+                {
+                    acc = op(std::move(acc), *it);
+                }
+                offsets[block + 1] = std::move(acc);
+            }
+        },
+        1);
+    for (size_t block = 1; block < num_block; block++)
+    {
+        offsets[block] = op(offsets[block - 1], offsets[block]);
+    }
+    parallel_for_range(
+        pool, num_block,
+        [&](size_t block_begin, size_t block_end) {
+            for (size_t block = block_begin; block < block_end; block++)
+            {
+                size_t begin = parallel_block_begin(size, num_block, block);
+                size_t end = parallel_block_begin(size, num_block, block + 1);
+                T acc = offsets[block];
+                for (size_t i = begin; i < end; i++)
+                {
+                    T next = op(acc, first[i]);
+                    d_first[i] = std::move(acc);
+                    acc = std::move(next);
+                }
+            }
+        },
+        1);
+    return d_first + size;
+}
+
+template <typename RandomIt, typename OutputIt, typename T>
+OutputIt parallel_exclusive_scan(ThreadPool &pool, RandomIt first, RandomIt last, OutputIt d_first, T init)
+{
+    return parallel_exclusive_scan(pool, first, last, d_first, std::move(init), std::plus<T>());
+}
+
+// Sample sort: splitters from a regular sample cut the input into buckets, blocks are classified and
+// scattered into a buffer in parallel, then every bucket is sorted in parallel. Elements equal to a
+// splitter get a bucket of their own that needs no sorting, so heavy duplicates do not serialize the sort.
+// Value must be default constructible for the scatter buffer. Not stable.
+template <typename RandomIt, typename Compare>
+void parallel_sort(ThreadPool &pool, RandomIt first, RandomIt last, Compare comp)
+{
+    using Value = typename std::iterator_traits<RandomIt>::value_type;
+    const size_t sequential_cutoff = 1 << 15;
+    const size_t oversample = 32;
+    size_t size = static_cast<size_t>(std::distance(first, last));
+    if (size < sequential_cutoff || pool.size() < 2)
+    {
+        std::sort(first, last, comp);
+        return;
+    }
+    size_t num_splitter = std::min(4 * pool.size(), size / sequential_cutoff * 2) - 1;
+    std::vector<Value> samples;
+    size_t stride = size / ((num_splitter + 1) * oversample);
+    for (size_t i = 0; i < (num_splitter + 1) * oversample; i++)
+    {
+        samples.push_back(first[i * stride + stride / 2]);
+    }
+    std::sort(samples.begin(), samples.end(), comp);
+    std::vector<Value> splitters;
+    for (size_t i = 1; i <= num_splitter; i++)
+    {
+        splitters.push_back(std::move(samples[i * oversample]));
+    }
+
+    // bucket 2k holds values between splitter k-1 and k, bucket 2k+1 values equal to splitter k
+    size_t num_bucket = 2 * num_splitter + 1;
+    size_t num_block = num_splitter + 1;
+    std::vector<uint16_t> bucket_ids(size);
+    std::vector<size_t> offsets(num_block * num_bucket, 0);
+    parallel_for_range(
+        pool, num_block,
+        [&](size_t block_begin, size_t block_end) {
+            for (size_t block = block_begin; block < block_end; block++)
+            {
+                size_t *counts = &offsets[block * num_bucket];
+                size_t end = parallel_block_begin(size, num_block, block + 1);
+                for (size_t i = parallel_block_begin(size, num_block, block); i < end; i++)
+                {
+                    size_t k = std::lower_bound(splitters.begin(), splitters.end(), first[i], comp) - splitters.begin();
+                    size_t bucket = k < num_splitter && !comp(first[i], splitters[k]) ? 2 * k + 1 : 2 * k;
+                    bucket_ids[i] = static_cast<uint16_t>(bucket);
+                    counts[bucket]++;
+                }
+            }
+        },
+        1);
+    // bucket-major exclusive scan of the counts gives every block its write position in each bucket
+    std::vector<size_t> bucket_begins(num_bucket + 1, 0);
+    size_t sum = 0;
+    for (size_t bucket = 0; bucket < num_bucket; bucket++)
+    {
+        bucket_begins[bucket] = sum;
+        for (size_t block = 0; block < num_block; block++)
+        {
+            size_t count = offsets[block * num_bucket + bucket];
+            offsets[block * num_bucket + bucket] = sum;
+            sum += count;
+        }
+    }
+    bucket_begins[num_bucket] = sum;
+
+    std::vector<Value> buffer(size);
+    parallel_for_range(
+        pool, num_block,
+        [&](size_t block_begin, size_t block_end) {
+            for (size_t block = block_begin; block < block_end; block++)
+            {
+                size_t *positions = &offsets[block * num_bucket];
+                size_t end = parallel_block_begin(size, num_block, block + 1);
+                for (size_t i = parallel_block_begin(size, num_block, block); i < end; i++)
+                {
+                    buffer[positions[bucket_ids[i]]++] = std::move(first[i]);
+                }
+            }
+        },
+        1);
+    parallel_for_range(
+        pool, num_bucket,
+        [&](size_t bucket_begin, size_t bucket_end) {
+            for (size_t bucket = bucket_begin; bucket < bucket_end; bucket++)
+            {
+                typename std::vector<Value>::iterator begin = buffer.begin() + bucket_begins[bucket];
+                typename std::vector<Value>::iterator end = buffer.begin() + bucket_begins[bucket + 1];
+                if (bucket % 2 == 0)
+                {
+                    std::sort(begin, end, comp);
+                }
+                std::move(begin, end, first + bucket_begins[bucket]);
+            }
+        },
+        1);
+}
+
+template <typename RandomIt> void parallel_sort(ThreadPool &pool, RandomIt first, RandomIt last)
+{
+    parallel_sort(pool, first, last, std::less<typename std::iterator_traits<RandomIt>::value_type>());
+}
+
+} // namespace toys
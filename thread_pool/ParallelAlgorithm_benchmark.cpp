@@ -0,0 +1,44 @@
+#include "ParallelAlgorithm.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <thread>
+#include <vector>
+
+template <typename F> double seconds(F &&f)
+{
+    auto start = std::chrono::steady_clock::now();
+    f();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+// usage: ParallelAlgorithm_benchmark [max_exponent], sizes 1e5 .. 1e{max_exponent}, default 1e8
+// 1e9 needs about 10 GB of memory (input, copy, scatter buffer and bucket ids)
+int main(int argc, char **argv)
+{
+    int max_exponent = argc > 1 ? atoi(argv[1]) : 8;
+    int num_worker = std::max(2u, std::thread::hardware_concurrency());
+    toys::ThreadPool tp(num_worker, toys::WORK_STEALING);
+    std::mt19937 rng(42);
+
+    printf("sort uint32, %d workers, seconds\n", num_worker);
+    printf("%12s %12s %14s %10s\n", "size", "std::sort", "parallel_sort", "speedup");
+    size_t size = 100000;
+    for (int exponent = 5; exponent <= max_exponent; exponent++, size *= 10)
+    {
+        std::vector<uint32_t> input(size);
+        for (uint32_t &x : input)
+        {
+            x = rng();
+        }
+        std::vector<uint32_t> v = input;
+        double serial = seconds([&v]() { std::sort(v.begin(), v.end()); });
+        v = input;
+        double parallel = seconds([&v, &tp]() { toys::parallel_sort(tp, v.begin(), v.end()); });
+        printf("%12zu %12.4f %14.4f %10.2f\n", size, serial, parallel, serial / parallel);
+    }
+    return 0;
+}
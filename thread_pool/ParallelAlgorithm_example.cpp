@@ -0,0 +1,36 @@
+#include "ParallelAlgorithm.hpp"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+int main(int argc, char **argv)
+{
+    toys::ThreadPool tp(4, toys::WORK_STEALING);
+
+    std::vector<double> v(1000000);
+    toys::parallel_for(tp, 0, static_cast<int>(v.size()), [&v](int i) { v[i] = std::sqrt(i); });
+    std::cout << v[4] << " " << v[v.size() - 1] << std::endl;
+
+    toys::parallel_for_each(tp, v.begin(), v.end(), [](double &x) { x = x * x; }, 1024, toys::SIMPLE_PARTITIONER);
+    std::cout << v[4] << " " << v[v.size() - 1] << std::endl;
+
+    double sum = toys::parallel_reduce(tp, v.begin(), v.end(), 0.0);
+    double sum_sqrt = toys::parallel_transform_reduce(tp, v.begin(), v.end(), 0.0, std::plus<double>(),
+                                                      [](double x) { return std::sqrt(x); });
+    std::cout << sum << " " << sum_sqrt << std::endl;
+
+    std::vector<int> ones(10, 1);
+    std::vector<int> prefix(ones.size());
+    toys::parallel_inclusive_scan(tp, ones.begin(), ones.end(), prefix.begin());
+    std::cout << prefix.front() << " " << prefix.back() << std::endl;
+    toys::parallel_exclusive_scan(tp, ones.begin(), ones.end(), prefix.begin(), 0);
+    std::cout << prefix.front() << " " << prefix.back() << std::endl;
+
+    std::vector<int> keys(100000);
+    toys::parallel_for(tp, 0, static_cast<int>(keys.size()), [&keys](int i) { keys[i] = (i * 7919) % 100003; });
+    toys::parallel_sort(tp, keys.begin(), keys.end());
+    std::cout << std::is_sorted(keys.begin(), keys.end()) << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,117 @@
+#pragma once
+#include "RingQueue.hpp"
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+namespace toys
+{
+
+// FIFO per priority level, the highest non-empty level is served first. To keep a steady stream of urgent
+// work from starving the rest, a non-empty level passed over `aging` times is served next regardless of
+// priority; aging <= 0 gives strict priority.
+template <typename T> class PriorityQueue
+{
+  private:
+    // var
+    std::vector<RingQueue<T>> m_levels;
+    std::vector<int> m_skipped; // pops that went to a higher level while this one waited
+    int m_aging;
+    size_t m_size;
+
+  public:
+    // func
+    PriorityQueue(size_t num_level, int aging);
+    ~PriorityQueue() = default;
+
+    // level is clamped to [0, num_level)
+    void push(T &&value, size_t level);
+    // level receives the level value came from
+    bool pop(T &value, size_t &level);
+    // the oldest entry of the lowest non-empty level, for shedding load
+    bool pop_lowest(T &value, size_t &level);
+    size_t size() const;
+    bool empty() const;
+    size_t num_level() const;
+};
+
+template <typename T>
+PriorityQueue<T>::PriorityQueue(size_t num_level, int aging)
+    : m_levels(num_level > 0 ? num_level : 1), m_skipped(m_levels.size(), 0), m_aging(aging), m_size(0)
+{
+}
+
+template <typename T> void PriorityQueue<T>::push(T &&value, size_t level)
+{
+    if (level >= m_levels.size())
+    {
+        level = m_levels.size() - 1;
+    }
+    m_levels[level].push(std::move(value));
+    m_size++;
+}
+
+template <typename T> bool PriorityQueue<T>::pop(T &value, size_t &level)
+{
+    if (m_size == 0)
+    {
+        return false;
+    }
+    size_t top = m_levels.size() - 1;
+    while (m_levels[top].empty())
+    {
+        top--;
+    }
+    level = top;
+    // age the levels being passed over, the highest starved one takes this turn
+    for (size_t i = top; i-- > 0;)
+    {
+        if (m_levels[i].empty())
+        {
+            continue;
+        }
+        if (++m_skipped[i] > m_aging && m_aging > 0 && level == top)
+        {
+            level = i;
+        }
+    }
+    m_skipped[level] = 0;
+    value = std::move(m_levels[level].front());
+    m_levels[level].pop();
+    m_size--;
+    return true;
+}
+
+template <typename T> bool PriorityQueue<T>::pop_lowest(T &value, size_t &level)
+{
+    if (m_size == 0)
+    {
+        return false;
+    }
+    level = 0;
+    while (m_levels[level].empty())
+    {
+        level++;
+    }
+    value = std::move(m_levels[level].front());
+    m_levels[level].pop();
+    m_size--;
+    return true;
+}
+
+template <typename T> size_t PriorityQueue<T>::size() const
+{
+    return m_size;
+}
+
+template <typename T> bool PriorityQueue<T>::empty() const
+{
+    return m_size == 0;
+}
+
+template <typename T> size_t PriorityQueue<T>::num_level() const
+{
+    return m_levels.size();
+}
+
+} // namespace toys
@@ -0,0 +1,87 @@
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+namespace toys
+{
+
+// Growable FIFO on a power-of-two circular buffer. Unlike std::queue (std::deque) it keeps its storage
+// once grown, so steady-state push/pop never allocate.
+template <typename T> class RingQueue
+{
+  private:
+    // var
+    std::unique_ptr<T[]> m_slots;
+    size_t m_capacity;
+    size_t m_head;
+    size_t m_size;
+    // func
+    void grow();
+
+  public:
+    // func
+    RingQueue(size_t capacity = 64);
+    ~RingQueue() = default;
+
+    void push(T &&value);
+    void pop();
+    T &front();
+    size_t size() const;
+    bool empty() const;
+};
+
+template <typename T> RingQueue<T>::RingQueue(size_t capacity) : m_capacity(1), m_head(0), m_size(0)
+{
+    while (m_capacity < capacity)
+    {
+        m_capacity <<= 1;
+    }
+    m_slots.reset(new T[m_capacity]);
+}
+
+template <typename T> void RingQueue<T>::grow()
+{
+    std::unique_ptr<T[]> slots(new T[m_capacity * 2]);
+    for (size_t i = 0; i < m_size; i++)
+    {
+        slots[i] = std::move(m_slots[(m_head + i) & (m_capacity - 1)]);
+    }
+    m_slots = std::move(slots);
+    m_capacity *= 2;
+    m_head = 0;
+}
+
+template <typename T> void RingQueue<T>::push(T &&value)
+{
+    if (m_size == m_capacity)
+    {
+        grow();
+    }
+    m_slots[(m_head + m_size) & (m_capacity - 1)] = std::move(value);
+    m_size++;
+}
+
+template <typename T> void RingQueue<T>::pop()
+{
+    m_slots[m_head] = T();
+    m_head = (m_head + 1) & (m_capacity - 1);
+    m_size--;
+}
+
+template <typename T> T &RingQueue<T>::front()
+{
+    return m_slots[m_head];
+}
+
+template <typename T> size_t RingQueue<T>::size() const
+{
+    return m_size;
+}
+
+template <typename T> bool RingQueue<T>::empty() const
+{
+    return m_size == 0;
+}
+
+} // namespace toys
@@ -0,0 +1,188 @@
+#pragma once
+#include "ThreadPool.hpp"
+#include "UniqueTask.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <utility>
+
+namespace toys
+{
+
+// Serial executor on a ThreadPool: tasks posted to one strand run one at a time and in posting order, each on
+// whichever worker picks the strand up. Posting pushes onto a lock-free stack; only the post that finds the
+// strand idle submits a drain task to the pool, and that drain runs up to `batch` queued tasks before handing
+// the rest back to the pool, so many strands share the workers fairly without a mutex per task. Drains are
+// exempt from a bounded pool's overflow policy, so a full pool delays a strand but never drops or stalls it.
+// Strand is a handle, copies refer to the same queue, which lives until its last task has run.
+class Strand
+{
+  private:
+    struct Node
+    {
+        UniqueTask task;
+        Node *next;
+    };
+    struct State
+    {
+        ThreadPool *pool;
+        size_t batch;
+        std::atomic<Node *> incoming;    // newest first, pushed by any thread
+        std::atomic<size_t> num_pending; // posted and not yet run, a drain is scheduled while it is non-zero
+        Node *ready;                     // oldest first, owned by the running drain
+        State(ThreadPool *pool, size_t batch);
+        ~State();
+    };
+
+    // var
+    std::shared_ptr<State> m_state;
+    // func
+    void push(UniqueTask task);
+    static void drain(const std::shared_ptr<State> &state);
+    static Node *take_incoming(State &state);
+    static const State *&current();
+
+  public:
+    // func
+    // batch is how many tasks a drain runs before requeueing the strand behind other pool work, at least 1
+    explicit Strand(ThreadPool &pool, size_t batch = 64);
+
+    template <typename F, typename... Args>
+    auto add(F &&f, Args &&...args) -> std::future<typename std::result_of<F(Args...)>::type>;
+    // exceptions escaping f go to the pool's error handler, like ThreadPool::post()
+    template <typename F> void post(F &&f);
+    // true inside a task of this strand
+    bool running_in_this_thread() const;
+    ThreadPool &pool() const;
+};
+
+Strand::State::State(ThreadPool *pool, size_t batch)
+    : pool(pool), batch(batch > 0 ? batch : 1), incoming(nullptr), num_pending(0), ready(nullptr)
+{
+}
+
+// only reached with tasks left over when the pool shut down before the drain ran
+Strand::State::~State()
+{
+    for (Node *list : {ready, incoming.load(std::memory_order_acquire)})
+    {
+        while (list != nullptr)
+        {
+            Node *next = list->next;
+            list->~Node();
+            SlabPool::deallocate(list, sizeof(Node));
+            list = next;
+        }
+    }
+}
+
+Strand::Strand(ThreadPool &pool, size_t batch) : m_state(std::make_shared<State>(&pool, batch))
+{
+}
+
+const Strand::State *&Strand::current()
+{
+    static thread_local const State *state = nullptr;
+    return state;
+}
+
+void Strand::push(UniqueTask task)
+{
+    Node *node = new (SlabPool::allocate(sizeof(Node))) Node{std::move(task), nullptr};
+    Node *head = m_state->incoming.load(std::memory_order_relaxed);
+    do
+    {
+        node->next = head;
+    } while (!m_state->incoming.compare_exchange_weak(head, node, std::memory_order_release,
+                                                      std::memory_order_relaxed));
+    // counted after the push, so a drain that sees the count also finds the node
+    if (m_state->num_pending.fetch_add(1, std::memory_order_acq_rel) == 0)
+    {
+        std::shared_ptr<State> state = m_state;
+        state->pool->push_drain(UniqueTask([state]() { drain(state); }));
+    }
+}
+
+// grabs everything pushed so far and reverses it into posting order
+Strand::Node *Strand::take_incoming(State &state)
+{
+    Node *list = state.incoming.exchange(nullptr, std::memory_order_acquire);
+    Node *ordered = nullptr;
+    while (list != nullptr)
+    {
+        Node *next = list->next;
+        list->next = ordered;
+        ordered = list;
+        list = next;
+    }
+    return ordered;
+}
+
+void Strand::drain(const std::shared_ptr<State> &state)
+{
+    const State *outer = current();
+    current() = state.get();
+    // a node is pushed before it is counted, so take_incoming() may return some that are not counted yet;
+    // they wait in ready for a later drain, running them now could bring the count to zero under a new drain
+    size_t num_run = 0;
+    size_t num_task = std::min(state->batch, state->num_pending.load(std::memory_order_acquire));
+    while (num_run < num_task)
+    {
+        if (state->ready == nullptr)
+        {
+            state->ready = take_incoming(*state);
+        }
+        Node *node = state->ready;
+        state->ready = node->next;
+        try
+        {
+            node->task();
+        }
+        catch (...)
+        {
+            state->pool->handle_error(std::current_exception());
+        }
+        node->~Node();
+        SlabPool::deallocate(node, sizeof(Node));
+        num_run++;
+    }
+    current() = outer;
+    // whoever brings the count to zero gives up the strand, otherwise it goes back behind the pool's queued work;
+    // post() would put it on this worker's deque, which runs it again before anything queued there earlier
+    if (state->num_pending.fetch_sub(num_run, std::memory_order_acq_rel) != num_run)
+    {
+        std::shared_ptr<State> next = state;
+        state->pool->push_drain(UniqueTask([next]() { drain(next); }));
+    }
+}
+
+template <typename F, typename... Args>
+auto Strand::add(F &&f, Args &&...args) -> std::future<typename std::result_of<F(Args...)>::type>
+{
+    using ReturnType = typename std::result_of<F(Args...)>::type;
+    std::promise<ReturnType> promise(std::allocator_arg, SlabAllocator<ReturnType>());
+    std::future<ReturnType> result = promise.get_future();
+    push(ThreadPool::make_task(std::move(promise), std::bind(std::forward<F>(f), std::forward<Args>(args)...)));
+    return result;
+}
+
+template <typename F> void Strand::post(F &&f)
+{
+    push(UniqueTask(std::forward<F>(f)));
+}
+
+bool Strand::running_in_this_thread() const
+{
+    return current() == m_state.get();
+}
+
+ThreadPool &Strand::pool() const
+{
+    return *m_state->pool;
+}
+
+} // namespace toys
@@ -0,0 +1,44 @@
+#include "Strand.hpp"
+#include <iostream>
+#include <string>
+#include <vector>
+
+int main(int argc, char **argv)
+{
+    toys::ThreadPool tp(4);
+
+    // each account is touched by one task at a time, so its balance needs no lock
+    const int num_account = 1000;
+    std::vector<toys::Strand> strands;
+    std::vector<long> balances(num_account, 0);
+    for (int i = 0; i < num_account; i++)
+    {
+        strands.emplace_back(tp);
+    }
+    for (int round = 0; round < 100; round++)
+    {
+        for (int i = 0; i < num_account; i++)
+        {
+            strands[i].post([&balances, i, round]() { balances[i] += round; });
+        }
+    }
+    tp.wait_idle();
+    long total = 0;
+    for (long balance : balances)
+    {
+        total += balance;
+    }
+    std::cout << "total " << total << std::endl;
+
+    // tasks of one strand keep their posting order
+    toys::Strand log(tp);
+    std::string text;
+    for (char c : std::string("in order"))
+    {
+        log.post([&text, c]() { text += c; });
+    }
+    std::future<std::string> done = log.add([&text, &log]() { return log.running_in_this_thread() ? text : ""; });
+    std::cout << done.get() << std::endl;
+
+    return 0;
+}
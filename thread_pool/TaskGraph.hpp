@@ -0,0 +1,230 @@
+#pragma once
+#include "ThreadPool.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <initializer_list>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+namespace toys
+{
+
+// DAG of tasks. Build it once, then run() it on a pool as many times as needed: a node is scheduled when
+// the last of its predecessors finishes, and a run allocates nothing. A graph must not run concurrently
+// with itself, or be modified while running.
+class TaskGraph
+{
+  public:
+    using NodeId = size_t;
+
+  private:
+    struct Node
+    {
+        TaskFunc func;
+        std::vector<NodeId> successors;
+        int num_predecessor;
+        std::atomic<int> pending; // predecessors not finished in the current run
+
+        Node(TaskFunc func);
+    };
+
+    // var
+    std::deque<Node> m_nodes; // deque, Node holds an atomic and cannot move
+    std::vector<NodeId> m_roots;
+    bool m_checked;
+    ThreadPool *m_pool;
+    std::atomic<size_t> m_remaining;
+    std::atomic<bool> m_failed;
+    std::exception_ptr m_error;
+    bool m_done;
+    std::mutex m_done_mutex;
+    std::condition_variable m_done_condition;
+    // func
+    void check();
+    void schedule(NodeId id);
+    void execute(NodeId id);
+
+  public:
+    // func
+    TaskGraph();
+    TaskGraph(const TaskGraph &) = delete;
+    TaskGraph &operator=(const TaskGraph &) = delete;
+    ~TaskGraph() = default;
+
+    NodeId add_node(TaskFunc func);
+    NodeId add_node(TaskFunc func, std::initializer_list<NodeId> predecessors);
+    void precede(NodeId before, NodeId after);
+    size_t size();
+    // blocks until every node has run, rethrows the first exception; later nodes are skipped after a failure
+    void run(ThreadPool &pool);
+};
+
+TaskGraph::Node::Node(TaskFunc func) : func(std::move(func)), num_predecessor(0), pending(0)
+{
+}
+
+TaskGraph::TaskGraph() : m_checked(false), m_pool(nullptr), m_remaining(0), m_failed(false), m_done(false)
+{
+}
+
+TaskGraph::NodeId TaskGraph::add_node(TaskFunc func)
+{
+    m_nodes.emplace_back(std::move(func));
+    m_checked = false;
+    return m_nodes.size() - 1;
+}
+
+TaskGraph::NodeId TaskGraph::add_node(TaskFunc func, std::initializer_list<NodeId> predecessors)
+{
+    NodeId id = add_node(std::move(func));
+    for (NodeId predecessor : predecessors)
+    {
+        precede(predecessor, id);
+    }
+    return id;
+}
+
+void TaskGraph::precede(NodeId before, NodeId after)
+{
+    if (before >= m_nodes.size() || after >= m_nodes.size())
+    {
+        throw std::out_of_range("TaskGraph node id out of range");
+    }
+    m_nodes[before].successors.push_back(after);
+    m_nodes[after].num_predecessor++;
+    m_checked = false;
+}
+
+size_t TaskGraph::size()
+{
+    return m_nodes.size();
+}
+
+// Kahn's algorithm, once per shape of the graph: collects the roots and rejects cycles, which would
+// otherwise make run() wait forever
+void TaskGraph::check()
+{
+    std::vector<int> in_degrees(m_nodes.size());
+    std::vector<NodeId> ready;
+    m_roots.clear();
+    for (NodeId id = 0; id < m_nodes.size(); id++)
+    {
+        in_degrees[id] = m_nodes[id].num_predecessor;
+        if (in_degrees[id] == 0)
+        {
+            m_roots.push_back(id);
+            ready.push_back(id);
+        }
+    }
+    size_t num_visited = 0;
+    while (!ready.empty())
+    {
+        NodeId id = ready.back();
+        ready.pop_back();
+        num_visited++;
+        for (NodeId successor : m_nodes[id].successors)
+        {
+            if (--in_degrees[successor] == 0)
+            {
+                ready.push_back(successor);
+            }
+        }
+    }
+    if (num_visited != m_nodes.size())
+    {
+        throw std::logic_error("TaskGraph contains a cycle");
+    }
+    m_checked = true;
+}
+
+void TaskGraph::run(ThreadPool &pool)
+{
+    if (!m_checked)
+    {
+        check();
+    }
+    if (m_nodes.empty())
+    {
+        return;
+    }
+    for (Node &node : m_nodes)
+    {
+        node.pending.store(node.num_predecessor, std::memory_order_relaxed);
+    }
+    m_pool = &pool;
+    m_remaining.store(m_nodes.size());
+    m_failed.store(false);
+    m_error = nullptr;
+    m_done = false;
+    for (NodeId id : m_roots)
+    {
+        schedule(id);
+    }
+    std::unique_lock<std::mutex> lock(m_done_mutex);
+    m_done_condition.wait(lock, [this]() -> bool { return m_done; });
+    if (m_error)
+    {
+        std::rethrow_exception(m_error);
+    }
+}
+
+void TaskGraph::schedule(NodeId id)
+{
+    m_pool->post([this, id]() { execute(id); });
+}
+
+void TaskGraph::execute(NodeId id)
+{
+    while (true)
+    {
+        Node &node = m_nodes[id];
+        if (!m_failed.load(std::memory_order_relaxed))
+        {
+            try
+            {
+                node.func();
+            }
+            catch (...)
+            {
+                if (!m_failed.exchange(true))
+                {
+                    m_error = std::current_exception();
+                }
+            }
+        }
+        // keep one ready successor on this thread instead of a round trip through the queue
+        NodeId next = m_nodes.size();
+        for (NodeId successor : node.successors)
+        {
+            if (m_nodes[successor].pending.fetch_sub(1) == 1)
+            {
+                if (next != m_nodes.size())
+                {
+                    schedule(next);
+                }
+                next = successor;
+            }
+        }
+        // once this node is counted off run() may return, so members are not touched past this point
+        // unless this thread still holds a ready successor
+        bool has_next = next != m_nodes.size();
+        if (m_remaining.fetch_sub(1) == 1)
+        {
+            std::lock_guard<std::mutex> lock(m_done_mutex);
+            m_done = true;
+            m_done_condition.notify_all();
+            return;
+        }
+        if (!has_next)
+        {
+            return;
+        }
+        id = next;
+    }
+}
+
+} // namespace toys
@@ -0,0 +1,22 @@
+#include "TaskGraph.hpp"
+#include <iostream>
+
+int main(int argc, char **argv)
+{
+    toys::ThreadPool tp(3);
+    int a = 0, b = 0, c = 0, d = 0;
+
+    // load -> left, right -> merge
+    toys::TaskGraph graph;
+    toys::TaskGraph::NodeId load = graph.add_node([&a]() { a = 1; });
+    toys::TaskGraph::NodeId left = graph.add_node([&a, &b]() { b = a + 1; }, {load});
+    toys::TaskGraph::NodeId right = graph.add_node([&a, &c]() { c = a + 2; }, {load});
+    graph.add_node([&b, &c, &d]() { d += b * c; }, {left, right});
+
+    for (int i = 0; i < 3; i++)
+    {
+        graph.run(tp);
+        std::cout << d << std::endl;
+    }
+    return 0;
+}
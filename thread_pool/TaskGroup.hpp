@@ -0,0 +1,156 @@
+#pragma once
+#include "ThreadPool.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <future>
+#include <mutex>
+#include <type_traits>
+#include <utility>
+
+namespace toys
+{
+
+// Fork-join scope on a ThreadPool. run() submits a task to the pool, wait() returns once every task of the group
+// has finished. A pool worker calling wait() keeps running queued pool tasks meanwhile instead of blocking, so
+// recursive fork-join (a group task that opens its own group and waits on it) cannot tie up every worker of a
+// fixed-size pool. Other threads block in wait().
+class TaskGroup
+{
+  private:
+    // a task the pool drops without running it (shutdown, DROP_OLDEST) still finishes, with broken_promise
+    template <typename F> struct GroupTask
+    {
+        TaskGroup *group;
+        F func;
+
+        GroupTask(TaskGroup *group, F &&func);
+        // noexcept when F's move is, so UniqueTask stores the task inline instead of on the heap
+        GroupTask(GroupTask &&other) noexcept(std::is_nothrow_move_constructible<F>::value);
+        ~GroupTask();
+        void operator()();
+    };
+
+    // var
+    ThreadPool *m_pool;
+    std::atomic<size_t> m_num_running;
+    std::mutex m_mutex; // the last task finishes under it, so wait() may return and the group be destroyed
+    std::condition_variable m_condition;
+    std::exception_ptr m_error; // first exception thrown by a task, under m_mutex
+    // func
+    void finish(std::exception_ptr error);
+
+  public:
+    // func
+    explicit TaskGroup(ThreadPool &pool);
+    TaskGroup(const TaskGroup &) = delete;
+    TaskGroup &operator=(const TaskGroup &) = delete;
+    // waits for tasks still running, their exceptions are dropped
+    ~TaskGroup();
+
+    template <typename F> void run(F &&f);
+    // rethrows the first exception a task threw, once all of them have finished
+    void wait();
+};
+
+TaskGroup::TaskGroup(ThreadPool &pool) : m_pool(&pool), m_num_running(0)
+{
+}
+
+TaskGroup::~TaskGroup()
+{
+    try
+    {
+        wait();
+    }
+    catch (...)
+    {
+    }
+}
+
+void TaskGroup::finish(std::exception_ptr error)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (error && !m_error)
+    {
+        m_error = error;
+    }
+    if (--m_num_running == 0)
+    {
+        m_condition.notify_all();
+    }
+}
+
+template <typename F>
+TaskGroup::GroupTask<F>::GroupTask(TaskGroup *group, F &&func) : group(group), func(std::move(func))
+{
+}
+
+template <typename F>
+TaskGroup::GroupTask<F>::GroupTask(GroupTask &&other) noexcept(std::is_nothrow_move_constructible<F>::value)
+    : group(other.group), func(std::move(other.func))
+{
+    other.group = nullptr;
+}
+
+template <typename F> TaskGroup::GroupTask<F>::~GroupTask()
+{
+    if (group != nullptr)
+    {
+        group->finish(std::make_exception_ptr(std::future_error(std::future_errc::broken_promise)));
+    }
+}
+
+template <typename F> void TaskGroup::GroupTask<F>::operator()()
+{
+    TaskGroup *owner = group;
+    group = nullptr;
+    std::exception_ptr error;
+    try
+    {
+        func();
+    }
+    catch (...)
+    {
+        error = std::current_exception();
+    }
+    owner->finish(error);
+}
+
+template <typename F> void TaskGroup::run(F &&f)
+{
+    m_num_running++;
+    m_pool->post(GroupTask<typename std::decay<F>::type>(this, typename std::decay<F>::type(std::forward<F>(f))));
+}
+
+void TaskGroup::wait()
+{
+    // Help while this worker finds queued pool work, otherwise sleep with a growing timeout: a group task running
+    // elsewhere may still fork work this worker could take, so it must not park until the group is done.
+    std::chrono::microseconds timeout(50);
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (m_num_running > 0)
+    {
+        lock.unlock();
+        bool helped = m_pool->run_pending_task(); // without the lock, the task may finish one of ours
+        lock.lock();
+        if (helped)
+        {
+            timeout = std::chrono::microseconds(50);
+            continue;
+        }
+        m_condition.wait_for(lock, timeout, [this]() -> bool { return m_num_running == 0; });
+        timeout = std::min(timeout * 2, std::chrono::microseconds(1000));
+    }
+    std::exception_ptr error = std::move(m_error);
+    m_error = nullptr;
+    lock.unlock();
+    if (error)
+    {
+        std::rethrow_exception(error);
+    }
+}
+
+} // namespace toys
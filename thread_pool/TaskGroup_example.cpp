@@ -0,0 +1,61 @@
+#include "TaskGroup.hpp"
+#include <algorithm>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+// every level forks a task and waits for it; with a blocking join the recursion would soon hold every worker
+void parallel_quicksort(toys::ThreadPool &tp, int *first, int *last)
+{
+    if (last - first < 1000)
+    {
+        std::sort(first, last);
+        return;
+    }
+    int pivot = first[(last - first) / 2];
+    int *middle1 = std::partition(first, last, [pivot](int x) { return x < pivot; });
+    int *middle2 = std::partition(middle1, last, [pivot](int x) { return x == pivot; });
+    toys::TaskGroup group(tp);
+    group.run([&tp, first, middle1]() { parallel_quicksort(tp, first, middle1); });
+    parallel_quicksort(tp, middle2, last);
+    group.wait();
+}
+
+int main(int argc, char **argv)
+{
+    toys::ThreadPool tp(2, toys::WORK_STEALING);
+
+    std::vector<int> values(1000000);
+    std::mt19937 rng(42);
+    for (int &v : values)
+    {
+        v = static_cast<int>(rng() % 100000);
+    }
+    toys::TaskGroup group(tp);
+    group.run([&tp, &values]() { parallel_quicksort(tp, values.data(), values.data() + values.size()); });
+    group.wait();
+    std::cout << "sorted " << std::is_sorted(values.begin(), values.end()) << std::endl;
+
+    // the first exception of the group comes out of wait()
+    toys::TaskGroup failing(tp);
+    for (int i = 0; i < 4; i++)
+    {
+        failing.run([i]() {
+            if (i == 2)
+            {
+                throw std::runtime_error("task 2 failed");
+            }
+        });
+    }
+    try
+    {
+        failing.wait();
+    }
+    catch (const std::runtime_error &e)
+    {
+        std::cout << e.what() << std::endl;
+    }
+
+    return 0;
+}
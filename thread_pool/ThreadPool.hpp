@@ -4,88 +4,2046 @@ https://github.com/vit-vit/CTPL
 https://github.com/progschj/ThreadPool
 */
 #pragma once
+#include "Cancellation.hpp"
+#include "FairQueue.hpp"
+#include "Histogram.hpp"
+#include "MPMCQueue.hpp"
+#include "PriorityQueue.hpp"
+#include "RingQueue.hpp"
+#include "UniqueTask.hpp"
+#include "WorkStealingDeque.hpp"
+#include <algorithm>
 #include <atomic>
+#include <chrono>
 #include <condition_variable>
+#include <cstdint>
+#include <fstream>
 #include <functional>
 #include <future>
+#include <iomanip>
+#include <iterator>
 #include <memory>
 #include <mutex>
-#include <queue>
+#include <stdexcept>
+#include <string>
 #include <thread>
 #include <vector>
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+#if defined(__cpp_impl_coroutine)
+#include <coroutine>
+#endif
 
 namespace toys
 {
 
 using TaskFunc = std::function<void()>;
+using ErrorHandler = std::function<void(std::exception_ptr)>;
+
+enum QueueMode
+{
+    CENTRAL_QUEUE, // all workers share one locked queue
+    WORK_STEALING, // per-worker deques, idle workers steal from random victims
+    LOCK_FREE,     // bounded lock-free ring shared by all workers, overflow goes to the central queue
+};
+
+// any int in [0, num_priority) is a priority, larger runs first; add() and post() use NORMAL_PRIORITY
+enum TaskPriority
+{
+    LOW_PRIORITY = 0,
+    NORMAL_PRIORITY = 1,
+    HIGH_PRIORITY = 2,
+};
+
+// What a submission does when max_pending tasks are already queued. Batches are admitted or refused whole.
+// FAIL_FAST and DROP_OLDEST lose tasks: futures of lost add() tasks report broken_promise, but helpers that
+// expect every posted task to run (TaskGraph, Future::then, co_await schedule()) would wait forever. Strand
+// is exempt: the drain that runs a strand's tasks is always queued, past max_pending, and never shed.
+enum OverflowPolicy
+{
+    BLOCK_SUBMITTER, // wait for room; a pool worker never blocks on its own pool and runs the tasks instead
+    FAIL_FAST,       // drop the new tasks
+    CALLER_RUNS,     // run the new tasks on the submitting thread
+    DROP_OLDEST,     // queue the new tasks and drop the oldest queued ones, lowest priority first
+};
+
+struct ThreadPoolOptions
+{
+    QueueMode queue_mode = CENTRAL_QUEUE;
+    size_t ring_capacity = 4096; // LOCK_FREE only
+    // an idle worker polls idle_spin times with a pause instruction, then idle_yield times with a yield,
+    // then parks on the condition variable; both 0 parks at once, which costs a futex wake-up per task
+    int idle_spin = 4096;
+    int idle_yield = 16;
+    // Linux only: worker i is pinned to cpus[i % cpus.size()], empty leaves workers to the scheduler
+    std::vector<int> cpus = {};
+    int num_priority = 3;    // priority levels, at least 3
+    int priority_aging = 16; // a waiting level passed over this many times runs next, <= 0 for strict priority
+    // Dynamic sizing, on when max_workers exceeds the constructor's num_worker, which becomes the minimum.
+    // One more worker starts when no worker is parked and either more than grow_pending tasks per worker are
+    // queued or every worker has been inside its current task for grow_wait. Submissions and workers taking a
+    // task with more queued check this, and a watcher thread rechecks every grow_wait while work is queued;
+    // workers above the minimum exit after keep_alive without work.
+    int max_workers = 0;
+    int grow_pending = 4;
+    std::chrono::milliseconds grow_wait = std::chrono::milliseconds(10);
+    std::chrono::milliseconds keep_alive = std::chrono::seconds(10);
+    // extra workers blocking() may start to stand in for workers blocked inside it; they exit once the blocking
+    // calls they cover return, or after keep_alive without work
+    int blocking_workers = 4;
+    size_t max_pending = 0; // bound on queued tasks, 0 for unbounded
+    OverflowPolicy overflow_policy = BLOCK_SUBMITTER;
+    // two clock reads per task for idle/busy time and the stats() histograms; queued tasks carry their submit
+    // time in a wrapper, which no longer fits a task's inline storage and costs one allocation per task
+    bool collect_timing = false;
+    // tracing: each worker keeps its last trace_capacity task runs for dump_trace(), 0 disables tracing
+    size_t trace_capacity = 0;
+    // one entry per tenant of add_tenant(), its share of the central queue when tenants compete
+    std::vector<int> tenant_weights = {};
+};
+
+// per worker slot that has run a worker, all times in ns and only with collect_timing
+struct WorkerStats
+{
+    uint64_t num_executed;
+    uint64_t num_stolen; // WORK_STEALING only, tasks taken from other workers' deques
+    int64_t idle_ns;     // between tasks: spinning, yielding and parked
+    int64_t busy_ns;     // running tasks
+    int64_t num_keyed;   // add_keyed() tasks waiting for this worker, a deep one points at a hot key
+};
+
+struct TenantStats
+{
+    int64_t depth; // queued now
+    uint64_t num_executed;
+    HistogramSnapshot wait_ns; // submit to start
+};
+
+struct ThreadPoolStats
+{
+    std::vector<WorkerStats> workers;
+    size_t num_live;
+    int64_t num_pending;
+    int64_t num_rejected;
+    uint64_t num_executed;     // sum over workers
+    HistogramSnapshot wait_ns; // submit to start, collect_timing only
+    HistogramSnapshot run_ns;  // start to end, collect_timing only
+    std::vector<TenantStats> tenants;
+};
 
 class ThreadPool
 {
   private:
+    // fields are atomic so dump_trace() can read a ring its worker is writing
+    struct TraceEvent
+    {
+        std::atomic<int64_t> begin_ns;
+        std::atomic<int64_t> end_ns;
+        std::atomic<const char *> label;
+    };
+    // one per worker slot, slots of retired workers are reused by later ones
+    struct Worker
+    {
+        WorkStealingDeque<UniqueTask *> deque; // WORK_STEALING only
+        uint64_t rand_state;
+        std::atomic<bool> live;                // changed under m_tasks_mutex
+        bool compensating;                     // started by blocking(), changed under m_tasks_mutex
+        std::atomic<int64_t> busy_since;       // dynamic sizing only, start of the running task in ns, 0 when idle
+        char busy_pad[64 - sizeof(std::atomic<int64_t>)];
+        // statistics, written by the slot's worker only and read by stats()
+        std::atomic<uint64_t> num_executed;
+        std::atomic<uint64_t> num_stolen;
+        std::atomic<int64_t> idle_ns;
+        std::atomic<int64_t> busy_ns;
+        Histogram wait_ns;
+        Histogram run_ns;
+        // trace ring, overwritten oldest first; the two counters let dump_trace() detect slots it raced with
+        std::unique_ptr<TraceEvent[]> trace;
+        std::atomic<uint64_t> trace_claimed; // events started
+        std::atomic<uint64_t> trace_head;    // events completely written
+        // add_keyed() tasks routed to this slot, only its own worker takes them
+        RingQueue<UniqueTask> keyed;
+        std::mutex keyed_mutex;
+        std::atomic<int64_t> num_keyed;
+
+        Worker(uint64_t seed);
+    };
+    // collect_timing only, records how long the task was queued into the histogram of the worker running it
+    struct TimedTask
+    {
+        UniqueTask task;
+        ThreadPool *pool;
+        int64_t submit_ns;
+
+        void operator()();
+    };
+    struct WorkerContext
+    {
+        ThreadPool *pool;
+        size_t index;
+        const char *label; // of the running task, set by LabeledTask
+    };
+    struct LabeledTask
+    {
+        UniqueTask task;
+        const char *label;
+
+        void operator()();
+    };
+    struct Tenant
+    {
+        std::atomic<int64_t> depth; // changed under m_tasks_mutex
+        std::atomic<uint64_t> num_executed;
+        Histogram wait_ns;
+
+        Tenant();
+    };
+    // records the tenant's queueing latency, whichever worker runs it
+    struct TenantTask
+    {
+        UniqueTask task;
+        Tenant *tenant;
+        int64_t submit_ns;
+
+        void operator()();
+    };
+    // leaves the blocking() region however f exits
+    struct BlockingScope
+    {
+        ThreadPool *pool;
+
+        ~BlockingScope();
+    };
+
     // var
     std::vector<std::thread> m_wokers;
-    std::queue<TaskFunc> m_tasks;
+    std::vector<std::unique_ptr<Worker>> m_locals;
+    PriorityQueue<UniqueTask> m_tasks;
+    FairQueue<UniqueTask> m_tenant_tasks; // central too, under m_tasks_mutex
+    bool m_tenant_turn;                   // alternates m_tasks and m_tenant_tasks while both hold normal work
+    // Strand drains, central too: a lost drain would stall its strand for good, so they are not counted against
+    // max_pending, never shed and never run on the caller; one per strand at most
+    RingQueue<UniqueTask> m_drains;
+    bool m_drain_turn; // drains and the other central tasks take turns, urgent ones still go first
+    std::vector<std::unique_ptr<Tenant>> m_tenants;
     std::mutex m_tasks_mutex;
     std::condition_variable m_condition;
+    std::unique_ptr<MPMCQueue<UniqueTask>> m_ring;
     std::atomic<bool> m_stop;
+    std::atomic<bool> m_closed; // shutdown started, only workers of this pool may still submit
+    QueueMode m_mode;
+    ThreadPoolOptions m_options;
+    std::atomic<int64_t> m_num_pending;  // tasks in m_tasks, m_ring, all deques and keyed queues
+    std::atomic<int64_t> m_num_keyed;    // tasks in keyed queues, which only their own worker may take
+    std::atomic<int64_t> m_num_central;  // tasks in m_tasks, m_tenant_tasks and m_drains
+    std::atomic<int64_t> m_num_urgent;   // tasks in m_tasks above NORMAL_PRIORITY
+    std::atomic<int64_t> m_num_sleeping; // workers blocked on m_condition
+    std::atomic<size_t> m_num_live;      // running workers, changed under m_tasks_mutex
+    // slots that ever ran a worker, under m_tasks_mutex; workers take the lowest free slot, so these come first
+    // and stats() and dump_trace() leave the rest out
+    std::atomic<size_t> m_num_used_slot;
+    size_t m_min_workers;
+    size_t m_max_workers; // slots maybe_grow() may fill, the rest are for blocking()
+    bool m_dynamic;
+    std::atomic<int64_t> m_num_blocking;     // workers inside blocking()
+    std::atomic<int64_t> m_num_compensating; // live workers started by blocking(), changed under m_tasks_mutex
+    std::atomic<int64_t> m_next_grow_check; // ns, spaces out grow checks
+    std::thread m_grow_watcher;               // dynamic sizing only, see watch_growth()
+    std::condition_variable m_grow_condition; // under m_tasks_mutex
+    std::atomic<bool> m_grow_idle;            // the watcher is parked until work is queued
+    std::atomic<int64_t> m_num_admitted;    // bounded queueing only, tasks admitted and not yet taken
+    std::atomic<int64_t> m_num_blocked;     // submitters waiting on m_space_condition
+    std::atomic<int64_t> m_num_rejected;
+    std::mutex m_space_mutex;
+    std::condition_variable m_space_condition;
+    std::atomic<int64_t> m_num_unfinished; // tasks submitted and not yet finished or dropped
+    std::atomic<int64_t> m_num_idle_waiters;
+    int64_t m_trace_epoch; // ns, trace timestamps are relative to pool construction
+    std::mutex m_idle_mutex;
+    std::condition_variable m_idle_condition;
+    ErrorHandler m_error_handler;
+    std::mutex m_error_handler_mutex;
     // func
-    void working();
+    void working(size_t index);
+    bool pop_task(UniqueTask &task, size_t index, int &num_bypass, bool take_keyed = true);
+    bool pop_central(UniqueTask &task);
+    bool steal_task(UniqueTask &task, size_t index);
+    bool pop_keyed(UniqueTask &task, Worker &local);
+    void take_pending();
+    void finish_tasks(size_t num_task);
+    void stop_workers();
+    std::vector<UniqueTask> take_queued();
+    bool push_task(UniqueTask task, int priority = NORMAL_PRIORITY, bool fail_fast = false);
+    // false when the tasks were not queued: refused, or already run by the caller
+    bool push_tasks(UniqueTask *tasks, size_t num_task, int priority = NORMAL_PRIORITY, bool fail_fast = false);
+    // for Strand drains, see m_drains; false once the pool is shut down
+    bool push_drain(UniqueTask task);
+    // the part of push_tasks() before queueing: refusal, admission and the timing wrapper
+    bool prepare_tasks(UniqueTask *tasks, size_t num_task, bool fail_fast, bool may_run_inline = true);
+    bool push_keyed(UniqueTask task, size_t index);
+    bool push_tenant(UniqueTask task, size_t tenant);
+    void check_tenant(size_t tenant);
+    bool admit(UniqueTask *tasks, size_t num_task, OverflowPolicy policy, bool may_run_inline);
+    bool try_admit(size_t num_task);
+    bool drop_oldest();
+    void run_inline(UniqueTask *tasks, size_t num_task);
+    void wake_workers(size_t num_task);
+    void start_worker(size_t index);
+    void maybe_grow();
+    void watch_growth();
+    bool retire(size_t index);
+    void enter_blocking();
+    void leave_blocking();
+    static int64_t now_ns();
+    template <typename T> static void add_relaxed(std::atomic<T> &counter, T value);
+    void record_trace(Worker &local, int64_t begin_ns, int64_t end_ns, const char *label);
+    static void write_json_string(std::ostream &out, const char *text);
+    void handle_error(std::exception_ptr error);
+    static ThreadPoolOptions mode_options(QueueMode mode);
+    static void check_cpus(const std::vector<int> &cpus);
+    static void pin_current_thread(int cpu);
+    static WorkerContext &current_worker();
+    static void cpu_relax();
+    template <typename R, typename Func> static UniqueTask make_task(std::promise<R> promise, Func func);
+
+    // drains report task errors through handle_error(), queue through push_drain() and build futures with
+    // make_task()
+    friend class Strand;
 
   public:
     // func
-    ThreadPool(int num_worker);
+    ThreadPool(int num_worker, QueueMode mode = CENTRAL_QUEUE);
+    ThreadPool(int num_worker, const ThreadPoolOptions &options);
+    // abandons queued tasks like shutdown_now(), their futures report broken_promise
     ~ThreadPool();
     template <typename F, typename... Args>
     auto add(F &&f, Args &&...args) -> std::future<typename std::result_of<F(Args...)>::type>;
+    template <typename F> void post(F &&f);
+    // tasks above NORMAL_PRIORITY run before normal ones, including those already in local deques or the ring
+    template <typename F, typename... Args>
+    auto add_priority(int priority, F &&f, Args &&...args)
+        -> std::future<typename std::result_of<F(Args...)>::type>;
+    template <typename F> void post_priority(int priority, F &&f);
+    // never block, run inline or drop queued work: with max_pending tasks queued the task is refused, and
+    // try_add returns a future without state (valid() == false)
+    template <typename F, typename... Args>
+    auto try_add(F &&f, Args &&...args) -> std::future<typename std::result_of<F(Args...)>::type>;
+    template <typename F> bool try_post(F &&f);
+    // label names the task in dump_trace(); it is not copied, so pass a string literal or other static string
+    template <typename F, typename... Args>
+    auto add_labeled(const char *label, F &&f, Args &&...args)
+        -> std::future<typename std::result_of<F(Args...)>::type>;
+    template <typename F> void post_labeled(const char *label, F &&f);
+    // The token is checked when a worker dequeues the task: a cancelled task is skipped, and add_cancellable's
+    // future holds TaskCancelled. A running task sees cancellation only by polling the token itself.
+    template <typename F, typename... Args>
+    auto add_cancellable(const CancellationToken &token, F &&f, Args &&...args)
+        -> std::future<typename std::result_of<F(Args...)>::type>;
+    template <typename F> void post_cancellable(const CancellationToken &token, F &&f);
+    // Tasks with equal keys go to the same worker, one of the first num_worker that never retire, and run there
+    // one at a time in submission order, so state sharded by key needs no locks. The worker keeps taking other
+    // work in between; stats().workers[i].num_keyed is its keyed backlog. Hashes key with std::hash<K>.
+    // A full bounded pool never runs a keyed task on the caller: CALLER_RUNS blocks like BLOCK_SUBMITTER, and from
+    // a pool worker the task is queued past max_pending; FAIL_FAST and DROP_OLDEST apply as usual.
+    template <typename K, typename F, typename... Args>
+    auto add_keyed(const K &key, F &&f, Args &&...args) -> std::future<typename std::result_of<F(Args...)>::type>;
+    template <typename K, typename F> void post_keyed(const K &key, F &&f);
+    // index of the worker add_keyed(key, ...) routes to; throws std::logic_error without permanent workers
+    template <typename K> size_t keyed_worker(const K &key);
+    // Queues the task for tenant, an index into ThreadPoolOptions::tenant_weights (std::out_of_range otherwise),
+    // in the central queue. Tenants share it by deficit round robin on their weights, taking turns with untagged
+    // central tasks, and urgent priorities still go first. stats().tenants has each tenant's depth and latency.
+    template <typename F, typename... Args>
+    auto add_tenant(size_t tenant, F &&f, Args &&...args) -> std::future<typename std::result_of<F(Args...)>::type>;
+    template <typename F> void post_tenant(size_t tenant, F &&f);
+    // bulk submission, the whole batch is queued under one lock with one round of wake-ups
+    template <typename InputIt>
+    auto add_bulk(InputIt first, InputIt last) -> std::vector<
+        std::future<typename std::result_of<typename std::iterator_traits<InputIt>::value_type()>::type>>;
+    template <typename G>
+    auto add_bulk_n(size_t num_task, G gen)
+        -> std::vector<std::future<typename std::result_of<typename std::result_of<G(size_t)>::type()>::type>>;
+    template <typename InputIt> std::future<void> post_range(InputIt first, InputIt last);
+    template <typename G> std::future<void> post_range_n(size_t num_task, G gen);
+    void set_error_handler(ErrorHandler handler);
+    // workers running now, between num_worker and max_workers with dynamic sizing
+    size_t size();
+    int64_t num_pending();
+    // tasks refused or dropped because the pool was full or shut down
+    int64_t num_rejected();
+    // counters are read without locks while workers keep running, so the snapshot is not one instant
+    ThreadPoolStats stats();
+    // writes the traced task runs as Chrome trace_event JSON, open it in chrome://tracing or ui.perfetto.dev;
+    // throws std::runtime_error when path cannot be written
+    void dump_trace(const std::string &path);
+    // blocks until every submitted task, including tasks they submit, has finished; not from a pool worker
+    void wait_idle();
+    // From a worker of this pool: takes one queued task the worker could run and runs it on the calling thread,
+    // for joins that help instead of blocking (see TaskGroup). Keyed tasks are left for the worker loop, so they
+    // stay one at a time. False when there was none or the caller is not a worker of this pool.
+    bool run_pending_task();
+    // Stops the workers; afterwards submissions are refused. With drain, queued tasks run first and pool workers
+    // may keep submitting until the pool is idle; without, each worker finishes its current task and queued
+    // tasks are destroyed, futures of add() tasks report broken_promise.
+    void shutdown(bool drain = true);
+    // Runs f on the calling thread. Called from a worker of this pool, it marks the worker as blocked for the
+    // duration, e.g. around file reads, and a stand-in worker takes over the queue meanwhile; see
+    // ThreadPoolOptions::blocking_workers.
+    template <typename F> auto blocking(F &&f) -> typename std::result_of<F()>::type;
+    // stops the workers after their current task and hands back the tasks that never started
+    std::vector<UniqueTask> shutdown_now();
+
+#if defined(__cpp_impl_coroutine)
+    // co_await pool.schedule() resumes the coroutine on a worker of this pool
+    class ScheduleAwaiter
+    {
+      private:
+        ThreadPool *m_pool;
+
+      public:
+        ScheduleAwaiter(ThreadPool *pool);
+        bool await_ready() noexcept;
+        void await_suspend(std::coroutine_handle<> handle);
+        void await_resume() noexcept;
+    };
+    ScheduleAwaiter schedule();
+#endif
 };
 
-ThreadPool::ThreadPool(int num_worker) : m_stop(false)
+ThreadPool::ThreadPool(int num_worker, QueueMode mode) : ThreadPool(num_worker, mode_options(mode))
+{
+}
+
+// ThreadPoolOptions{mode} would need C++14, aggregates with default member initializers
+ThreadPoolOptions ThreadPool::mode_options(QueueMode mode)
+{
+    ThreadPoolOptions options;
+    options.queue_mode = mode;
+    return options;
+}
+
+ThreadPool::Worker::Worker(uint64_t seed)
+    : rand_state(seed), live(false), compensating(false), busy_since(0), num_executed(0), num_stolen(0), idle_ns(0),
+      busy_ns(0), trace_claimed(0), trace_head(0), num_keyed(0)
+{
+}
+
+void ThreadPool::LabeledTask::operator()()
+{
+    current_worker().label = label;
+    task();
+}
+
+ThreadPool::Tenant::Tenant() : depth(0), num_executed(0)
+{
+}
+
+void ThreadPool::TenantTask::operator()()
+{
+    tenant->wait_ns.record_shared(now_ns() - submit_ns);
+    tenant->num_executed.fetch_add(1, std::memory_order_relaxed);
+    task();
+}
+
+ThreadPool::BlockingScope::~BlockingScope()
+{
+    pool->leave_blocking();
+}
+
+void ThreadPool::TimedTask::operator()()
+{
+    // tasks handed back by shutdown_now() may run anywhere
+    WorkerContext &context = current_worker();
+    if (context.pool == pool)
+    {
+        pool->m_locals[context.index]->wait_ns.record(now_ns() - submit_ns);
+    }
+    task();
+}
+
+// single writer, a plain load and store instead of a locked read-modify-write
+template <typename T> void ThreadPool::add_relaxed(std::atomic<T> &counter, T value)
+{
+    counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+ThreadPool::ThreadPool(int num_worker, const ThreadPoolOptions &options)
+    : m_tasks(std::max(options.num_priority, 3), options.priority_aging), m_tenant_tasks(options.tenant_weights),
+      m_tenant_turn(false), m_drain_turn(false), m_stop(false), m_closed(false),
+      m_mode(options.queue_mode), m_options(options), m_num_pending(0), m_num_keyed(0), m_num_central(0),
+      m_num_urgent(0),
+      m_num_sleeping(0), m_num_live(0), m_num_used_slot(std::max(num_worker, 0)),
+      m_min_workers(std::max(num_worker, 0)),
+      m_max_workers(std::max(options.max_workers, num_worker)), m_dynamic(options.max_workers > num_worker),
+      m_num_blocking(0), m_num_compensating(0), m_next_grow_check(0), m_grow_idle(false), m_num_admitted(0),
+      m_num_blocked(0), m_num_rejected(0), m_num_unfinished(0), m_num_idle_waiters(0), m_trace_epoch(now_ns())
 {
-    for (int i = 0; i < num_worker; i++)
+    check_cpus(m_options.cpus);
+    if (m_mode == LOCK_FREE)
+    {
+        m_ring.reset(new MPMCQueue<UniqueTask>(m_options.ring_capacity));
+    }
+    for (size_t i = 0; i < m_options.tenant_weights.size(); i++)
+    {
+        m_tenants.emplace_back(new Tenant());
+    }
+    size_t num_slot = m_max_workers + std::max(m_options.blocking_workers, 0);
+    for (size_t i = 0; i < num_slot; i++)
+    {
+        m_locals.emplace_back(new Worker(0x9E3779B97F4A7C15ULL * (i + 1)));
+        if (m_options.trace_capacity > 0)
+        {
+            m_locals.back()->trace.reset(new TraceEvent[m_options.trace_capacity]);
+        }
+    }
+    m_wokers.resize(num_slot);
+    for (size_t i = 0; i < m_min_workers; i++)
+    {
+        m_locals[i]->live = true;
+        m_num_live++;
+        m_wokers[i] = std::thread(&ThreadPool::working, this, i);
+    }
+    if (m_dynamic)
     {
-        m_wokers.emplace_back(&ThreadPool::working, this);
+        m_grow_watcher = std::thread(&ThreadPool::watch_growth, this);
     }
 }
 
 ThreadPool::~ThreadPool()
 {
-    m_stop.store(true);
+    m_closed.store(true);
+    stop_workers();
+    for (std::unique_ptr<Worker> &local : m_locals)
+    {
+        UniqueTask *task_ptr;
+        while (local->deque.pop(task_ptr))
+        {
+            UniqueTask::destroy(task_ptr);
+        }
+    }
+}
+
+void ThreadPool::stop_workers()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_tasks_mutex);
+        m_stop.store(true);
+    }
     m_condition.notify_all();
+    m_grow_condition.notify_all();
+    {
+        std::lock_guard<std::mutex> lock(m_space_mutex);
+    }
+    m_space_condition.notify_all();
+    if (m_grow_watcher.joinable())
+    {
+        m_grow_watcher.join();
+    }
+    // m_stop was set under m_tasks_mutex, so maybe_grow() no longer refills slots
     for (std::thread &worker : m_wokers)
     {
-        worker.join();
+        if (worker.joinable())
+        {
+            worker.join();
+        }
+    }
+}
+
+void ThreadPool::wait_idle()
+{
+    if (current_worker().pool == this)
+    {
+        throw std::logic_error("ThreadPool::wait_idle called from one of its workers");
+    }
+    std::unique_lock<std::mutex> lock(m_idle_mutex);
+    m_num_idle_waiters++;
+    m_idle_condition.wait(lock, [this]() -> bool { return m_num_unfinished == 0; });
+    m_num_idle_waiters--;
+}
+
+bool ThreadPool::run_pending_task()
+{
+    WorkerContext &context = current_worker();
+    if (context.pool != this || m_stop)
+    {
+        return false;
+    }
+    UniqueTask task;
+    int num_bypass = 0; // aging is left to the worker loop
+    // the caller may be a keyed task itself, the next one for its key would run nested inside it
+    if (!pop_task(task, context.index, num_bypass, false))
+    {
+        return false;
+    }
+    // the helped task runs inside the caller's, only its label has to be put back for the trace
+    const char *label = context.label;
+    context.label = nullptr;
+    try
+    {
+        task();
+    }
+    catch (...)
+    {
+        handle_error(std::current_exception());
+    }
+    task = UniqueTask();
+    context.label = label;
+    add_relaxed<uint64_t>(m_locals[context.index]->num_executed, 1);
+    finish_tasks(1);
+    return true;
+}
+
+void ThreadPool::shutdown(bool drain)
+{
+    if (current_worker().pool == this)
+    {
+        throw std::logic_error("ThreadPool::shutdown called from one of its workers");
+    }
+    // pairs with the m_num_unfinished increment in push_tasks(): an outside submission either sees m_closed
+    // or is counted before wait_idle() looks
+    m_closed.store(true);
+    if (drain)
+    {
+        wait_idle();
+    }
+    stop_workers();
+    // after a drain nothing is left; the tasks are destroyed before they count as finished, so their futures
+    // report broken_promise by the time wait_idle() returns
+    size_t num_task;
+    {
+        std::vector<UniqueTask> tasks = take_queued();
+        num_task = tasks.size();
+    }
+    finish_tasks(num_task);
+}
+
+std::vector<UniqueTask> ThreadPool::shutdown_now()
+{
+    if (current_worker().pool == this)
+    {
+        throw std::logic_error("ThreadPool::shutdown_now called from one of its workers");
+    }
+    m_closed.store(true);
+    stop_workers();
+    std::vector<UniqueTask> tasks = take_queued();
+    finish_tasks(tasks.size());
+    return tasks;
+}
+
+// called once the workers are joined, every queue is the caller's now; the tasks still count as unfinished
+std::vector<UniqueTask> ThreadPool::take_queued()
+{
+    std::vector<UniqueTask> tasks;
+    UniqueTask task;
+    size_t priority;
+    {
+        std::lock_guard<std::mutex> lock(m_tasks_mutex);
+        while (m_tasks.pop(task, priority))
+        {
+            tasks.push_back(std::move(task));
+        }
+        size_t tenant;
+        while (m_tenant_tasks.pop(task, tenant))
+        {
+            m_tenants[tenant]->depth--;
+            tasks.push_back(std::move(task));
+        }
+        for (; !m_drains.empty(); m_drains.pop())
+        {
+            tasks.push_back(std::move(m_drains.front()));
+        }
+        m_num_central = 0;
+        m_num_urgent = 0;
+    }
+    while (m_mode == LOCK_FREE && m_ring->try_pop(task))
+    {
+        tasks.push_back(std::move(task));
+    }
+    for (std::unique_ptr<Worker> &local : m_locals)
+    {
+        UniqueTask *task_ptr;
+        while (local->deque.steal(task_ptr))
+        {
+            tasks.push_back(std::move(*task_ptr));
+            UniqueTask::destroy(task_ptr);
+        }
+        for (; !local->keyed.empty(); local->keyed.pop())
+        {
+            tasks.push_back(std::move(local->keyed.front()));
+        }
+        m_num_keyed -= local->num_keyed;
+        local->num_keyed = 0;
+    }
+    m_num_pending -= tasks.size();
+    return tasks;
+}
+
+ThreadPool::WorkerContext &ThreadPool::current_worker()
+{
+    static thread_local WorkerContext context{nullptr, 0, nullptr};
+    return context;
+}
+
+int64_t ThreadPool::now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+void ThreadPool::cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
+// rejects cpus the process may not run on before any worker starts, so pinning in a worker cannot fail
+void ThreadPool::check_cpus(const std::vector<int> &cpus)
+{
+#if defined(__linux__)
+    if (cpus.empty())
+    {
+        return;
+    }
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+    {
+        throw std::runtime_error("ThreadPool cannot read the process cpu affinity");
+    }
+    for (int cpu : cpus)
+    {
+        if (cpu < 0 || cpu >= CPU_SETSIZE || !CPU_ISSET(cpu, &allowed))
+        {
+            throw std::invalid_argument("ThreadPool cpu " + std::to_string(cpu) + " is not available");
+        }
     }
+#else
+    (void)cpus;
+#endif
+}
+
+void ThreadPool::pin_current_thread(int cpu)
+{
+#if defined(__linux__)
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    CPU_SET(cpu, &cpu_set);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set);
+#else
+    (void)cpu;
+#endif
 }
 
-void ThreadPool::working()
+void ThreadPool::working(size_t index)
 {
-    while (true)
+    current_worker() = {this, index, nullptr};
+    if (!m_options.cpus.empty())
+    {
+        pin_current_thread(m_options.cpus[index % m_options.cpus.size()]);
+    }
+    Worker &local = *m_locals[index];
+    bool timing = m_options.collect_timing;
+    bool tracing = m_options.trace_capacity > 0;
+    int64_t idle_since = timing ? now_ns() : 0;
+    int idle_round = 0;
+    int num_bypass = 0;
+    while (!m_stop)
     {
+        UniqueTask task;
+        if (pop_task(task, index, num_bypass))
+        {
+            idle_round = 0;
+            // a burst queued while a worker was parked skipped the submit-side check, the backlog shows here
+            if (m_dynamic && m_num_pending > m_num_keyed)
+            {
+                maybe_grow();
+            }
+            int64_t start = timing || tracing || m_dynamic ? now_ns() : 0;
+            if (m_dynamic)
+            {
+                local.busy_since.store(start, std::memory_order_relaxed);
+            }
+            try
+            {
+                task();
+            }
+            catch (...)
+            {
+                // only post() tasks get here, add() stores exceptions in the future
+                handle_error(std::current_exception());
+            }
+            if (m_dynamic)
+            {
+                local.busy_since.store(0, std::memory_order_relaxed);
+            }
+            task = UniqueTask(); // captures are released before the task counts as finished
+            add_relaxed<uint64_t>(local.num_executed, 1);
+            if (tracing)
+            {
+                record_trace(local, start, now_ns(), current_worker().label);
+                current_worker().label = nullptr;
+            }
+            if (timing)
+            {
+                int64_t end = now_ns();
+                local.run_ns.record(end - start);
+                add_relaxed<int64_t>(local.busy_ns, end - start);
+                add_relaxed<int64_t>(local.idle_ns, start - idle_since);
+                idle_since = end;
+            }
+            // last, so stats() after wait_idle() includes this task
+            finish_tasks(1);
+            // the blocking() call this worker stood in for has returned
+            if (local.compensating && m_num_compensating > m_num_blocking)
+            {
+                std::lock_guard<std::mutex> lock(m_tasks_mutex);
+                if (m_num_compensating > m_num_blocking && retire(index))
+                {
+                    return;
+                }
+            }
+            continue;
+        }
+        if (idle_round < m_options.idle_spin)
+        {
+            idle_round++;
+            cpu_relax();
+            continue;
+        }
+        if (idle_round - m_options.idle_spin < m_options.idle_yield)
+        {
+            idle_round++;
+            std::this_thread::yield();
+            continue;
+        }
+        idle_round = 0;
         std::unique_lock<std::mutex> lock(m_tasks_mutex);
-        m_condition.wait(lock, [this]() -> bool { return !m_tasks.empty() || m_stop; });
-        if (m_stop)
+        m_num_sleeping++;
+        // other workers' keyed tasks are no reason to wake up
+        auto has_work = [this, &local]() -> bool
+        { return m_num_pending > m_num_keyed || local.num_keyed > 0 || m_stop; };
+        if (index < m_min_workers)
         {
-            break;
+            m_condition.wait(lock, has_work);
         }
-        TaskFunc task(std::move(m_tasks.front()));
-        m_tasks.pop();
-        lock.unlock();
-        task();
+        else if (!m_condition.wait_for(lock, m_options.keep_alive, has_work) && retire(index))
+        {
+            m_num_sleeping--;
+            return;
+        }
+        m_num_sleeping--;
     }
 }
 
-template <typename F, typename... Args>
-auto ThreadPool::add(F &&f, Args &&...args) -> std::future<typename std::result_of<F(Args...)>::type>
+// called with m_tasks_mutex held by a worker that found no work for keep_alive or is no longer needed as a stand-in
+bool ThreadPool::retire(size_t index)
 {
-    using ReturnType = typename std::result_of<F(Args...)>::type;
-    auto pkgt_ptr =
-        std::make_shared<std::packaged_task<ReturnType()>>(std::bind(std::forward<F>(f), std::forward<Args>(args)...));
-    std::future<ReturnType> result = pkgt_ptr->get_future();
+    // the first m_min_workers slots stay, add_keyed() routes to them; maybe_grow() and blocking() refill the others
+    if (index < m_min_workers)
     {
-        std::lock_guard<std::mutex> lock(m_tasks_mutex);
-        m_tasks.emplace([pkgt_ptr]() { (*pkgt_ptr)(); });
+        return false;
+    }
+    Worker &local = *m_locals[index];
+    if (local.compensating)
+    {
+        local.compensating = false;
+        m_num_compensating--;
+    }
+    local.live = false;
+    m_num_live--;
+    return true;
+}
+
+void ThreadPool::enter_blocking()
+{
+    std::lock_guard<std::mutex> lock(m_tasks_mutex);
+    m_num_blocking++;
+    // a stand-in left over from an earlier blocking() call is reused, it is parked or about to find the queue
+    if (m_stop || m_num_compensating >= m_num_blocking ||
+        m_num_compensating >= static_cast<int64_t>(m_options.blocking_workers))
+    {
+        return;
+    }
+    size_t index = m_min_workers;
+    while (m_locals[index]->live)
+    {
+        index++;
+    }
+    m_locals[index]->live = true;
+    m_locals[index]->compensating = true;
+    m_num_live++;
+    m_num_compensating++;
+    start_worker(index);
+}
+
+// the stand-in retires after its current task, or after keep_alive if it is parked
+void ThreadPool::leave_blocking()
+{
+    m_num_blocking--;
+}
+
+// called with m_tasks_mutex held; a previous thread of the slot has retired and released the mutex, so joining
+// it here cannot deadlock
+void ThreadPool::start_worker(size_t index)
+{
+    m_num_used_slot = std::max<size_t>(m_num_used_slot, index + 1);
+    if (m_wokers[index].joinable())
+    {
+        m_wokers[index].join();
+    }
+    m_wokers[index] = std::thread(&ThreadPool::working, this, index);
+}
+
+void ThreadPool::maybe_grow()
+{
+    // m_num_pending was raised before this, the same handshake as m_num_sleeping wakes a parked watcher
+    if (m_grow_idle)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_tasks_mutex);
+        }
+        m_grow_condition.notify_one();
+    }
+    if (m_num_sleeping > 0 || m_num_live - static_cast<size_t>(m_num_compensating) >= m_max_workers)
+    {
+        return;
+    }
+    // at most one check per millisecond, so a burst of submissions does not start a crowd of workers at once
+    int64_t now = now_ns();
+    int64_t next_check = m_next_grow_check.load(std::memory_order_relaxed);
+    if (now < next_check || !m_next_grow_check.compare_exchange_strong(next_check, now + 1000000))
+    {
+        return;
+    }
+    // keyed tasks are not counted, a new worker could not take them
+    size_t num_live = m_num_live;
+    int64_t num_pending = m_num_pending - m_num_keyed;
+    bool grow = num_pending > static_cast<int64_t>(num_live) * m_options.grow_pending;
+    if (!grow && num_pending > 0)
+    {
+        // every worker stuck in a long task, e.g. blocked on I/O, while work is queued
+        int64_t stuck_since = now - std::chrono::duration_cast<std::chrono::nanoseconds>(m_options.grow_wait).count();
+        grow = true;
+        for (std::unique_ptr<Worker> &local : m_locals)
+        {
+            int64_t busy_since = local->busy_since.load(std::memory_order_relaxed);
+            if (local->live && (busy_since == 0 || busy_since > stuck_since))
+            {
+                grow = false;
+                break;
+            }
+        }
+    }
+    if (!grow)
+    {
+        return;
+    }
+    // under the lock, so the destructor never joins a slot while it is being refilled; the slots beyond
+    // m_max_workers are left for blocking(), so a free one exists while the check below fails
+    std::lock_guard<std::mutex> lock(m_tasks_mutex);
+    if (m_stop || m_num_live - static_cast<size_t>(m_num_compensating) >= m_max_workers)
+    {
+        return;
+    }
+    size_t index = 0;
+    while (m_locals[index]->live)
+    {
+        index++;
+    }
+    m_locals[index]->live = true;
+    m_num_live++;
+    start_worker(index);
+}
+
+// Rechecks growth every grow_wait while work is queued, so workers stuck in long tasks get help even when
+// nothing is being submitted or dequeued; parks while the queues are empty.
+void ThreadPool::watch_growth()
+{
+    std::unique_lock<std::mutex> lock(m_tasks_mutex);
+    while (!m_stop)
+    {
+        if (m_num_pending > m_num_keyed)
+        {
+            m_grow_condition.wait_for(lock, m_options.grow_wait);
+            lock.unlock();
+            maybe_grow();
+            lock.lock();
+            continue;
+        }
+        m_grow_idle = true;
+        m_grow_condition.wait(lock, [this]() -> bool { return m_num_pending > m_num_keyed || m_stop; });
+        m_grow_idle = false;
+    }
+}
+
+// num_bypass counts tasks taken from the deques or the ring while the central queue was not empty
+bool ThreadPool::pop_task(UniqueTask &task, size_t index, int &num_bypass, bool take_keyed)
+{
+    // prioritized tasks only live in the central queue, look there first when it holds urgent ones or when
+    // lower ones have waited behind the local deque and the ring for too long
+    bool central_first =
+        m_num_urgent > 0 || (m_options.priority_aging > 0 && num_bypass >= m_options.priority_aging);
+    if (central_first && pop_central(task))
+    {
+        num_bypass = 0;
+        return true;
+    }
+    // no other worker may run this one's keyed tasks, so they come before work the others can take
+    if (take_keyed && pop_keyed(task, *m_locals[index]))
+    {
+        num_bypass = m_num_central > 0 ? num_bypass + 1 : 0;
+        return true;
+    }
+    UniqueTask *task_ptr;
+    if (m_mode == WORK_STEALING && m_locals[index]->deque.pop(task_ptr))
+    {
+        take_pending();
+        task = std::move(*task_ptr);
+        UniqueTask::destroy(task_ptr);
+    }
+    else if (m_mode == LOCK_FREE && m_ring->try_pop(task))
+    {
+        take_pending();
+    }
+    else if (!central_first && pop_central(task))
+    {
+        num_bypass = 0;
+        return true;
+    }
+    else if (!(m_mode == WORK_STEALING && steal_task(task, index)))
+    {
+        return false;
+    }
+    num_bypass = m_num_central > 0 ? num_bypass + 1 : 0;
+    return true;
+}
+
+bool ThreadPool::pop_central(UniqueTask &task)
+{
+    if (m_num_central == 0)
+    {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(m_tasks_mutex);
+    if (!m_drains.empty() && m_num_urgent == 0 && (m_drain_turn || (m_tasks.empty() && m_tenant_tasks.empty())))
+    {
+        m_drain_turn = false;
+        task = std::move(m_drains.front());
+        m_drains.pop();
+        m_num_central--;
+        m_num_pending--; // not admitted, take_pending() would release room it never held
+        return true;
+    }
+    m_drain_turn = !m_drains.empty();
+    // urgent untagged tasks first, otherwise the two queues take turns
+    bool from_tenants = !m_tenant_tasks.empty() && (m_tasks.empty() || (m_num_urgent == 0 && m_tenant_turn));
+    m_tenant_turn = !from_tenants;
+    size_t priority = NORMAL_PRIORITY;
+    size_t tenant;
+    if (from_tenants)
+    {
+        m_tenant_tasks.pop(task, tenant);
+        m_tenants[tenant]->depth--;
+    }
+    else if (!m_tasks.pop(task, priority))
+    {
+        return false;
+    }
+    m_num_central--;
+    take_pending();
+    if (priority > NORMAL_PRIORITY)
+    {
+        m_num_urgent--;
+    }
+    return true;
+}
+
+bool ThreadPool::steal_task(UniqueTask &task, size_t index)
+{
+    // xorshift64, only touched by the owning worker
+    uint64_t &x = m_locals[index]->rand_state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    size_t num_worker = m_locals.size();
+    size_t start = x % num_worker;
+    for (size_t i = 0; i < num_worker; i++)
+    {
+        size_t victim = (start + i) % num_worker;
+        UniqueTask *task_ptr;
+        if (victim != index && m_locals[victim]->deque.steal(task_ptr))
+        {
+            take_pending();
+            add_relaxed<uint64_t>(m_locals[index]->num_stolen, 1);
+            task = std::move(*task_ptr);
+            UniqueTask::destroy(task_ptr);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool ThreadPool::pop_keyed(UniqueTask &task, Worker &local)
+{
+    if (local.num_keyed == 0)
+    {
+        return false;
+    }
+    {
+        // drop_oldest() may have emptied the queue since
+        std::lock_guard<std::mutex> lock(local.keyed_mutex);
+        if (local.keyed.empty())
+        {
+            return false;
+        }
+        task = std::move(local.keyed.front());
+        local.keyed.pop();
+    }
+    // before take_pending(), m_num_pending - m_num_keyed may overstate the shared work but never understate it
+    local.num_keyed--;
+    m_num_keyed--;
+    take_pending();
+    return true;
+}
+
+// a task left m_tasks, m_ring, a deque or a keyed queue, to run or to be dropped
+void ThreadPool::take_pending()
+{
+    m_num_pending--;
+    if (m_options.max_pending == 0)
+    {
+        return;
+    }
+    m_num_admitted--;
+    // same handshake as m_num_sleeping: a submitter registers before testing for room
+    if (m_num_blocked > 0)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_space_mutex);
+        }
+        m_space_condition.notify_all();
+    }
+}
+
+void ThreadPool::finish_tasks(size_t num_task)
+{
+    if (num_task == 0)
+    {
+        return;
+    }
+    // same handshake as take_pending(), for wait_idle()
+    if (m_num_unfinished.fetch_sub(num_task) == static_cast<int64_t>(num_task) && m_num_idle_waiters > 0)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_idle_mutex);
+        }
+        m_idle_condition.notify_all();
+    }
+}
+
+// reserves room for the batch; a batch larger than max_pending fits into an empty pool
+bool ThreadPool::try_admit(size_t num_task)
+{
+    int64_t admitted = m_num_admitted.load();
+    while (admitted == 0 || admitted + static_cast<int64_t>(num_task) <= static_cast<int64_t>(m_options.max_pending))
+    {
+        if (m_num_admitted.compare_exchange_weak(admitted, admitted + num_task))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// true when the batch should be queued
+bool ThreadPool::admit(UniqueTask *tasks, size_t num_task, OverflowPolicy policy, bool may_run_inline)
+{
+    if (try_admit(num_task))
+    {
+        return true;
+    }
+    bool from_worker = current_worker().pool == this;
+    if (policy == BLOCK_SUBMITTER && from_worker)
+    {
+        policy = CALLER_RUNS;
+    }
+    // tasks that must not run on the caller (keyed ones) wait for room instead, or go over the bound when the
+    // caller is a worker that must not block on its own pool
+    if (policy == CALLER_RUNS && !may_run_inline)
+    {
+        if (from_worker)
+        {
+            m_num_admitted += num_task;
+            return true;
+        }
+        policy = BLOCK_SUBMITTER;
+    }
+    switch (policy)
+    {
+    case BLOCK_SUBMITTER:
+    {
+        std::unique_lock<std::mutex> lock(m_space_mutex);
+        m_num_blocked++;
+        bool admitted = false;
+        m_space_condition.wait(lock, [this, num_task, &admitted]() -> bool
+                               { return m_stop || (admitted = try_admit(num_task)); });
+        m_num_blocked--;
+        // woken by the shutdown: the workers are gone and shutdown_now() may have emptied the queues already
+        if (m_stop)
+        {
+            if (admitted)
+            {
+                m_num_admitted -= num_task;
+            }
+            m_num_rejected += num_task;
+            return false;
+        }
+        return true;
+    }
+    case FAIL_FAST:
+        m_num_rejected += num_task;
+        return false;
+    case CALLER_RUNS:
+        run_inline(tasks, num_task);
+        return false;
+    case DROP_OLDEST:
+        m_num_admitted += num_task;
+        while (m_num_admitted > static_cast<int64_t>(m_options.max_pending) && drop_oldest())
+        {
+            m_num_rejected++;
+        }
+        return true;
+    }
+    return true;
+}
+
+bool ThreadPool::drop_oldest()
+{
+    UniqueTask task; // destroyed after the lock is released, a dropped add() task breaks its promise there
+    if (m_num_central > 0)
+    {
+        std::lock_guard<std::mutex> lock(m_tasks_mutex);
+        // the tenant that queued most sheds first
+        size_t tenant;
+        if (m_tenant_tasks.pop_longest(task, tenant))
+        {
+            m_tenants[tenant]->depth--;
+            m_num_central--;
+            take_pending();
+            finish_tasks(1);
+            return true;
+        }
+        size_t priority;
+        if (m_tasks.pop_lowest(task, priority))
+        {
+            m_num_central--;
+            take_pending();
+            if (priority > NORMAL_PRIORITY)
+            {
+                m_num_urgent--;
+            }
+            finish_tasks(1);
+            return true;
+        }
+    }
+    if (m_mode == LOCK_FREE && m_ring->try_pop(task))
+    {
+        take_pending();
+        finish_tasks(1);
+        return true;
+    }
+    if (m_mode == WORK_STEALING)
+    {
+        for (std::unique_ptr<Worker> &local : m_locals)
+        {
+            UniqueTask *task_ptr;
+            if (local->deque.steal(task_ptr))
+            {
+                take_pending();
+                UniqueTask::destroy(task_ptr);
+                finish_tasks(1);
+                return true;
+            }
+        }
+    }
+    for (std::unique_ptr<Worker> &local : m_locals)
+    {
+        std::unique_lock<std::mutex> lock(local->keyed_mutex);
+        if (!local->keyed.empty())
+        {
+            task = std::move(local->keyed.front());
+            local->keyed.pop();
+            lock.unlock();
+            local->num_keyed--;
+            m_num_keyed--;
+            take_pending();
+            finish_tasks(1);
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::run_inline(UniqueTask *tasks, size_t num_task)
+{
+    for (size_t i = 0; i < num_task; i++)
+    {
+        try
+        {
+            tasks[i]();
+        }
+        catch (...)
+        {
+            handle_error(std::current_exception());
+        }
+    }
+}
+
+bool ThreadPool::push_task(UniqueTask task, int priority, bool fail_fast)
+{
+    return push_tasks(&task, 1, priority, fail_fast);
+}
+
+bool ThreadPool::prepare_tasks(UniqueTask *tasks, size_t num_task, bool fail_fast, bool may_run_inline)
+{
+    m_num_unfinished += num_task;
+    if (m_closed && current_worker().pool != this)
+    {
+        m_num_rejected += num_task;
+        finish_tasks(num_task);
+        return false;
+    }
+    OverflowPolicy policy = fail_fast ? FAIL_FAST : m_options.overflow_policy;
+    if (m_options.max_pending > 0 && !admit(tasks, num_task, policy, may_run_inline))
+    {
+        finish_tasks(num_task);
+        return false;
+    }
+    if (m_options.collect_timing)
+    {
+        int64_t submit_ns = now_ns();
+        for (size_t i = 0; i < num_task; i++)
+        {
+            tasks[i] = UniqueTask(TimedTask{std::move(tasks[i]), this, submit_ns});
+        }
+    }
+    return true;
+}
+
+bool ThreadPool::push_tasks(UniqueTask *tasks, size_t num_task, int priority, bool fail_fast)
+{
+    if (num_task == 0)
+    {
+        return true;
+    }
+    if (!prepare_tasks(tasks, num_task, fail_fast))
+    {
+        return false;
+    }
+    priority = std::min(std::max(priority, 0), static_cast<int>(m_tasks.num_level()) - 1);
+    size_t num_pushed = 0; // tasks pushed without taking m_tasks_mutex
+    WorkerContext &context = current_worker();
+    // deques and the ring are plain FIFOs, other priorities always go through the central queue
+    bool fifo = priority == NORMAL_PRIORITY;
+    if (fifo && m_mode == WORK_STEALING && context.pool == this)
+    {
+        for (; num_pushed < num_task; num_pushed++)
+        {
+            m_locals[context.index]->deque.push(UniqueTask::create(std::move(tasks[num_pushed])));
+        }
+    }
+    else if (fifo && m_mode == LOCK_FREE)
+    {
+        while (num_pushed < num_task && m_ring->try_push(std::move(tasks[num_pushed])))
+        {
+            num_pushed++;
+        }
+    }
+    if (num_pushed == num_task)
+    {
+        m_num_pending += num_task;
+        // pairs with m_num_sleeping++ before the wait predicate, one of the two sides sees the other
+        if (m_num_sleeping == 0)
+        {
+            if (m_dynamic)
+            {
+                maybe_grow();
+            }
+            return true;
+        }
+        // empty critical section, a worker between its predicate check and wait() cannot miss the notify
+        std::lock_guard<std::mutex> lock(m_tasks_mutex);
+    }
+    else
+    {
+        // the central queue, also takes the overflow of a full ring
+        std::lock_guard<std::mutex> lock(m_tasks_mutex);
+        for (size_t i = num_pushed; i < num_task; i++)
+        {
+            m_tasks.push(std::move(tasks[i]), priority);
+        }
+        m_num_central += num_task - num_pushed;
+        if (priority > NORMAL_PRIORITY)
+        {
+            m_num_urgent += num_task - num_pushed;
+        }
+        m_num_pending += num_task;
+    }
+    wake_workers(num_task);
+    if (m_dynamic)
+    {
+        maybe_grow();
+    }
+    return true;
+}
+
+bool ThreadPool::push_keyed(UniqueTask task, size_t index)
+{
+    // a keyed task run by the caller would overlap the keyed worker's tasks for the same key
+    if (!prepare_tasks(&task, 1, false, false))
+    {
+        return false;
+    }
+    Worker &local = *m_locals[index];
+    {
+        std::lock_guard<std::mutex> lock(local.keyed_mutex);
+        local.keyed.push(std::move(task));
+    }
+    // m_num_pending first, so m_num_pending - m_num_keyed never understates the shared work
+    m_num_pending++;
+    local.num_keyed++;
+    m_num_keyed++;
+    if (m_num_sleeping > 0)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_tasks_mutex);
+        }
+        // notify_one() could pick a worker other than the one that must run the task
+        m_condition.notify_all();
+    }
+    return true;
+}
+
+bool ThreadPool::push_drain(UniqueTask task)
+{
+    m_num_unfinished++;
+    if (m_closed && current_worker().pool != this)
+    {
+        m_num_rejected++;
+        finish_tasks(1);
+        return false;
+    }
+    if (m_options.collect_timing)
+    {
+        task = UniqueTask(TimedTask{std::move(task), this, now_ns()});
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_tasks_mutex);
+        m_drains.push(std::move(task));
+        m_num_central++;
+        m_num_pending++;
+    }
+    wake_workers(1);
+    if (m_dynamic)
+    {
+        maybe_grow();
+    }
+    return true;
+}
+
+void ThreadPool::check_tenant(size_t tenant)
+{
+    if (tenant >= m_tenants.size())
+    {
+        throw std::out_of_range("ThreadPool tenant " + std::to_string(tenant) + " is not in tenant_weights");
+    }
+}
+
+bool ThreadPool::push_tenant(UniqueTask task, size_t tenant)
+{
+    if (!prepare_tasks(&task, 1, false))
+    {
+        return false;
+    }
+    Tenant *counters = m_tenants[tenant].get();
+    task = UniqueTask(TenantTask{std::move(task), counters, now_ns()});
+    {
+        std::lock_guard<std::mutex> lock(m_tasks_mutex);
+        m_tenant_tasks.push(std::move(task), tenant);
+        counters->depth++;
+        m_num_central++;
+        m_num_pending++;
+    }
+    wake_workers(1);
+    if (m_dynamic)
+    {
+        maybe_grow();
+    }
+    return true;
+}
+
+void ThreadPool::wake_workers(size_t num_task)
+{
+    // spinning workers find the tasks themselves; a worker parking concurrently registered in m_num_sleeping
+    // under m_tasks_mutex before checking the predicate, and the pusher took that mutex after queueing
+    size_t num_sleeping = m_num_sleeping;
+    if (num_sleeping == 0)
+    {
+        return;
+    }
+    if (num_task == 1)
+    {
+        m_condition.notify_one();
+        return;
+    }
+    // wake min(num_task, sleeping workers)
+    if (num_task >= num_sleeping)
+    {
+        m_condition.notify_all();
+        return;
+    }
+    for (size_t i = 0; i < num_task; i++)
+    {
+        m_condition.notify_one();
+    }
+}
+
+// the promise travels inside the task, so the callable and the result channel need no separate allocation
+template <typename R, typename Func> struct PromiseTask
+{
+    std::promise<R> promise;
+    Func func;
+
+    void operator()()
+    {
+        try
+        {
+            promise.set_value(func());
+        }
+        catch (...)
+        {
+            promise.set_exception(std::current_exception());
+        }
+    }
+};
+
+template <typename Func> struct PromiseTask<void, Func>
+{
+    std::promise<void> promise;
+    Func func;
+
+    void operator()()
+    {
+        try
+        {
+            func();
+            promise.set_value();
+        }
+        catch (...)
+        {
+            promise.set_exception(std::current_exception());
+        }
+    }
+};
+
+template <typename R, typename Func> struct CancellablePromiseTask
+{
+    PromiseTask<R, Func> task;
+    CancellationToken token;
+
+    void operator()()
+    {
+        if (token.is_cancelled())
+        {
+            task.promise.set_exception(std::make_exception_ptr(TaskCancelled()));
+            return;
+        }
+        task();
+    }
+};
+
+template <typename Func> struct CancellableTask
+{
+    Func func;
+    CancellationToken token;
+
+    void operator()()
+    {
+        if (!token.is_cancelled())
+        {
+            func();
+        }
+    }
+};
+
+template <typename R, typename Func> UniqueTask ThreadPool::make_task(std::promise<R> promise, Func func)
+{
+    return UniqueTask(PromiseTask<R, Func>{std::move(promise), std::move(func)});
+}
+
+void ThreadPool::set_error_handler(ErrorHandler handler)
+{
+    std::lock_guard<std::mutex> lock(m_error_handler_mutex);
+    m_error_handler = std::move(handler);
+}
+
+size_t ThreadPool::size()
+{
+    return m_num_live;
+}
+
+// tasks queued but not started, a hint for adaptive splitting
+int64_t ThreadPool::num_pending()
+{
+    return m_num_pending.load(std::memory_order_relaxed);
+}
+
+int64_t ThreadPool::num_rejected()
+{
+    return m_num_rejected.load(std::memory_order_relaxed);
+}
+
+void ThreadPool::record_trace(Worker &local, int64_t begin_ns, int64_t end_ns, const char *label)
+{
+    uint64_t head = local.trace_head.load(std::memory_order_relaxed);
+    local.trace_claimed.store(head + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    TraceEvent &event = local.trace[head % m_options.trace_capacity];
+    event.begin_ns.store(begin_ns - m_trace_epoch, std::memory_order_relaxed);
+    event.end_ns.store(end_ns - m_trace_epoch, std::memory_order_relaxed);
+    event.label.store(label, std::memory_order_relaxed);
+    local.trace_head.store(head + 1, std::memory_order_release);
+}
+
+void ThreadPool::write_json_string(std::ostream &out, const char *text)
+{
+    out << '"';
+    for (; *text != '\0'; text++)
+    {
+        unsigned char c = static_cast<unsigned char>(*text);
+        if (c == '"' || c == '\\')
+        {
+            out << '\\' << *text;
+        }
+        else if (c < 0x20)
+        {
+            const char *hex = "0123456789abcdef";
+            out << "\\u00" << hex[c >> 4] << hex[c & 15];
+        }
+        else
+        {
+            out << *text;
+        }
+    }
+    out << '"';
+}
+
+void ThreadPool::dump_trace(const std::string &path)
+{
+    std::ofstream out(path);
+    if (!out)
+    {
+        throw std::runtime_error("ThreadPool cannot write trace to " + path);
+    }
+    // ts and dur are microseconds, three decimals keep them exact to the nanosecond where the default
+    // precision would print 2.50032e+06 a few seconds into the trace
+    out << std::fixed << std::setprecision(3);
+    out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    bool first = true;
+    size_t num_used_slot = m_num_used_slot;
+    for (size_t index = 0; index < num_used_slot; index++)
+    {
+        out << (first ? "" : ",") << "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << index
+            << ",\"args\":{\"name\":\"worker " << index << "\"}}";
+        first = false;
+        Worker &local = *m_locals[index];
+        if (!local.trace)
+        {
+            continue;
+        }
+        size_t capacity = m_options.trace_capacity;
+        uint64_t head = local.trace_head.load(std::memory_order_acquire);
+        uint64_t begin = head > capacity ? head - capacity : 0;
+        std::vector<int64_t> times;
+        std::vector<const char *> labels;
+        for (uint64_t i = begin; i < head; i++)
+        {
+            TraceEvent &event = local.trace[i % capacity];
+            times.push_back(event.begin_ns.load(std::memory_order_relaxed));
+            times.push_back(event.end_ns.load(std::memory_order_relaxed));
+            labels.push_back(event.label.load(std::memory_order_relaxed));
+        }
+        // the worker keeps running, skip the events it started overwriting while we copied
+        std::atomic_thread_fence(std::memory_order_acquire);
+        uint64_t claimed = local.trace_claimed.load(std::memory_order_relaxed);
+        uint64_t first_valid = claimed > capacity ? claimed - capacity : 0;
+        for (uint64_t i = first_valid > begin ? first_valid - begin : 0; i < labels.size(); i++)
+        {
+            out << ",\n{\"name\":";
+            write_json_string(out, labels[i] != nullptr ? labels[i] : "task");
+            out << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << index << ",\"ts\":" << times[2 * i] / 1000.0
+                << ",\"dur\":" << (times[2 * i + 1] - times[2 * i]) / 1000.0 << "}";
+        }
+    }
+    out << "\n]}\n";
+    if (!out)
+    {
+        throw std::runtime_error("ThreadPool cannot write trace to " + path);
+    }
+}
+
+ThreadPoolStats ThreadPool::stats()
+{
+    ThreadPoolStats stats;
+    stats.num_live = m_num_live;
+    stats.num_pending = num_pending();
+    stats.num_rejected = num_rejected();
+    stats.num_executed = 0;
+    size_t num_used_slot = m_num_used_slot;
+    for (size_t index = 0; index < num_used_slot; index++)
+    {
+        Worker *local = m_locals[index].get();
+        WorkerStats worker;
+        worker.num_executed = local->num_executed.load(std::memory_order_relaxed);
+        worker.num_stolen = local->num_stolen.load(std::memory_order_relaxed);
+        worker.idle_ns = local->idle_ns.load(std::memory_order_relaxed);
+        worker.busy_ns = local->busy_ns.load(std::memory_order_relaxed);
+        worker.num_keyed = local->num_keyed;
+        stats.workers.push_back(worker);
+        stats.num_executed += worker.num_executed;
+        stats.wait_ns.merge(local->wait_ns);
+        stats.run_ns.merge(local->run_ns);
+    }
+    for (std::unique_ptr<Tenant> &counters : m_tenants)
+    {
+        TenantStats tenant;
+        tenant.depth = counters->depth;
+        tenant.num_executed = counters->num_executed.load(std::memory_order_relaxed);
+        tenant.wait_ns.merge(counters->wait_ns);
+        stats.tenants.push_back(tenant);
+    }
+    return stats;
+}
+
+#if defined(__cpp_impl_coroutine)
+ThreadPool::ScheduleAwaiter::ScheduleAwaiter(ThreadPool *pool) : m_pool(pool)
+{
+}
+
+bool ThreadPool::ScheduleAwaiter::await_ready() noexcept
+{
+    return false;
+}
+
+void ThreadPool::ScheduleAwaiter::await_suspend(std::coroutine_handle<> handle)
+{
+    m_pool->post([handle]() { handle.resume(); });
+}
+
+void ThreadPool::ScheduleAwaiter::await_resume() noexcept
+{
+}
+
+ThreadPool::ScheduleAwaiter ThreadPool::schedule()
+{
+    return ScheduleAwaiter(this);
+}
+#endif
+
+void ThreadPool::handle_error(std::exception_ptr error)
+{
+    ErrorHandler handler;
+    {
+        std::lock_guard<std::mutex> lock(m_error_handler_mutex);
+        handler = m_error_handler;
+    }
+    // without a handler the exception is dropped
+    if (handler)
+    {
+        handler(error);
+    }
+}
+
+template <typename F, typename... Args>
+auto ThreadPool::add(F &&f, Args &&...args) -> std::future<typename std::result_of<F(Args...)>::type>
+{
+    using ReturnType = typename std::result_of<F(Args...)>::type;
+    std::promise<ReturnType> promise(std::allocator_arg, SlabAllocator<ReturnType>());
+    std::future<ReturnType> result = promise.get_future();
+    push_task(make_task(std::move(promise), std::bind(std::forward<F>(f), std::forward<Args>(args)...)));
+    return result;
+}
+
+template <typename F> void ThreadPool::post(F &&f)
+{
+    push_task(UniqueTask(std::forward<F>(f)));
+}
+
+template <typename F, typename... Args>
+auto ThreadPool::add_priority(int priority, F &&f, Args &&...args)
+    -> std::future<typename std::result_of<F(Args...)>::type>
+{
+    using ReturnType = typename std::result_of<F(Args...)>::type;
+    std::promise<ReturnType> promise(std::allocator_arg, SlabAllocator<ReturnType>());
+    std::future<ReturnType> result = promise.get_future();
+    push_task(make_task(std::move(promise), std::bind(std::forward<F>(f), std::forward<Args>(args)...)), priority);
+    return result;
+}
+
+template <typename F> void ThreadPool::post_priority(int priority, F &&f)
+{
+    push_task(UniqueTask(std::forward<F>(f)), priority);
+}
+
+template <typename F, typename... Args>
+auto ThreadPool::try_add(F &&f, Args &&...args) -> std::future<typename std::result_of<F(Args...)>::type>
+{
+    using ReturnType = typename std::result_of<F(Args...)>::type;
+    std::promise<ReturnType> promise(std::allocator_arg, SlabAllocator<ReturnType>());
+    std::future<ReturnType> result = promise.get_future();
+    UniqueTask task = make_task(std::move(promise), std::bind(std::forward<F>(f), std::forward<Args>(args)...));
+    if (!push_task(std::move(task), NORMAL_PRIORITY, true))
+    {
+        return std::future<ReturnType>();
+    }
+    return result;
+}
+
+template <typename F> bool ThreadPool::try_post(F &&f)
+{
+    return push_task(UniqueTask(std::forward<F>(f)), NORMAL_PRIORITY, true);
+}
+
+template <typename F, typename... Args>
+auto ThreadPool::add_labeled(const char *label, F &&f, Args &&...args)
+    -> std::future<typename std::result_of<F(Args...)>::type>
+{
+    using ReturnType = typename std::result_of<F(Args...)>::type;
+    std::promise<ReturnType> promise(std::allocator_arg, SlabAllocator<ReturnType>());
+    std::future<ReturnType> result = promise.get_future();
+    UniqueTask task = make_task(std::move(promise), std::bind(std::forward<F>(f), std::forward<Args>(args)...));
+    // without tracing nobody reads the label, skip the wrapper and its allocation
+    if (m_options.trace_capacity > 0)
+    {
+        task = UniqueTask(LabeledTask{std::move(task), label});
+    }
+    push_task(std::move(task));
+    return result;
+}
+
+template <typename F, typename... Args>
+auto ThreadPool::add_cancellable(const CancellationToken &token, F &&f, Args &&...args)
+    -> std::future<typename std::result_of<F(Args...)>::type>
+{
+    using ReturnType = typename std::result_of<F(Args...)>::type;
+    using Func = decltype(std::bind(std::forward<F>(f), std::forward<Args>(args)...));
+    std::promise<ReturnType> promise(std::allocator_arg, SlabAllocator<ReturnType>());
+    std::future<ReturnType> result = promise.get_future();
+    push_task(UniqueTask(CancellablePromiseTask<ReturnType, Func>{
+        {std::move(promise), std::bind(std::forward<F>(f), std::forward<Args>(args)...)}, token}));
+    return result;
+}
+
+template <typename F> void ThreadPool::post_cancellable(const CancellationToken &token, F &&f)
+{
+    push_task(UniqueTask(CancellableTask<typename std::decay<F>::type>{std::forward<F>(f), token}));
+}
+
+template <typename K, typename F, typename... Args>
+auto ThreadPool::add_keyed(const K &key, F &&f, Args &&...args)
+    -> std::future<typename std::result_of<F(Args...)>::type>
+{
+    size_t index = keyed_worker(key);
+    using ReturnType = typename std::result_of<F(Args...)>::type;
+    std::promise<ReturnType> promise(std::allocator_arg, SlabAllocator<ReturnType>());
+    std::future<ReturnType> result = promise.get_future();
+    push_keyed(make_task(std::move(promise), std::bind(std::forward<F>(f), std::forward<Args>(args)...)), index);
+    return result;
+}
+
+template <typename K, typename F> void ThreadPool::post_keyed(const K &key, F &&f)
+{
+    push_keyed(UniqueTask(std::forward<F>(f)), keyed_worker(key));
+}
+
+template <typename K> size_t ThreadPool::keyed_worker(const K &key)
+{
+    if (m_min_workers == 0)
+    {
+        throw std::logic_error("ThreadPool::add_keyed needs num_worker > 0");
+    }
+    // std::hash of an integer is often the integer itself, the multiply spreads strided keys and pointers
+    uint64_t hash = static_cast<uint64_t>(std::hash<K>()(key)) * 0x9E3779B97F4A7C15ULL;
+    return static_cast<size_t>((hash >> 32) % m_min_workers);
+}
+
+template <typename F> auto ThreadPool::blocking(F &&f) -> typename std::result_of<F()>::type
+{
+    if (current_worker().pool != this)
+    {
+        return std::forward<F>(f)();
+    }
+    enter_blocking();
+    BlockingScope scope{this};
+    return std::forward<F>(f)();
+}
+
+template <typename F, typename... Args>
+auto ThreadPool::add_tenant(size_t tenant, F &&f, Args &&...args)
+    -> std::future<typename std::result_of<F(Args...)>::type>
+{
+    check_tenant(tenant);
+    using ReturnType = typename std::result_of<F(Args...)>::type;
+    std::promise<ReturnType> promise(std::allocator_arg, SlabAllocator<ReturnType>());
+    std::future<ReturnType> result = promise.get_future();
+    push_tenant(make_task(std::move(promise), std::bind(std::forward<F>(f), std::forward<Args>(args)...)), tenant);
+    return result;
+}
+
+template <typename F> void ThreadPool::post_tenant(size_t tenant, F &&f)
+{
+    check_tenant(tenant);
+    push_tenant(UniqueTask(std::forward<F>(f)), tenant);
+}
+
+template <typename F> void ThreadPool::post_labeled(const char *label, F &&f)
+{
+    UniqueTask task(std::forward<F>(f));
+    if (m_options.trace_capacity > 0)
+    {
+        task = UniqueTask(LabeledTask{std::move(task), label});
+    }
+    push_task(std::move(task));
+}
+
+template <typename InputIt>
+auto ThreadPool::add_bulk(InputIt first, InputIt last) -> std::vector<
+    std::future<typename std::result_of<typename std::iterator_traits<InputIt>::value_type()>::type>>
+{
+    using Func = typename std::iterator_traits<InputIt>::value_type;
+    using ReturnType = typename std::result_of<Func()>::type;
+    std::vector<std::future<ReturnType>> results;
+    std::vector<UniqueTask> tasks;
+    for (; first != last; ++first)
+    {
+        std::promise<ReturnType> promise(std::allocator_arg, SlabAllocator<ReturnType>());
+        results.push_back(promise.get_future());
+        tasks.push_back(make_task(std::move(promise), Func(*first)));
+    }
+    push_tasks(tasks.data(), tasks.size());
+    return results;
+}
+
+template <typename G>
+auto ThreadPool::add_bulk_n(size_t num_task, G gen)
+    -> std::vector<std::future<typename std::result_of<typename std::result_of<G(size_t)>::type()>::type>>
+{
+    using Func = typename std::result_of<G(size_t)>::type;
+    using ReturnType = typename std::result_of<Func()>::type;
+    std::vector<std::future<ReturnType>> results;
+    std::vector<UniqueTask> tasks;
+    results.reserve(num_task);
+    tasks.reserve(num_task);
+    for (size_t i = 0; i < num_task; i++)
+    {
+        std::promise<ReturnType> promise(std::allocator_arg, SlabAllocator<ReturnType>());
+        results.push_back(promise.get_future());
+        tasks.push_back(make_task(std::move(promise), gen(i)));
+    }
+    push_tasks(tasks.data(), tasks.size());
+    return results;
+}
+
+// shared by all tasks of one post_range batch, the last task to finish fulfils the promise
+struct BulkState
+{
+    std::atomic<size_t> remaining;
+    std::atomic<bool> failed;
+    std::exception_ptr error;
+    std::promise<void> promise;
+
+    BulkState(size_t num_task);
+    void finish();
+};
+
+BulkState::BulkState(size_t num_task) : remaining(num_task), failed(false)
+{
+}
+
+void BulkState::finish()
+{
+    if (remaining.fetch_sub(1) != 1)
+    {
+        return;
+    }
+    if (error)
+    {
+        promise.set_exception(error);
+    }
+    else
+    {
+        promise.set_value();
+    }
+}
+
+template <typename Func> struct BulkTask
+{
+    std::shared_ptr<BulkState> state;
+    Func func;
+
+    void operator()()
+    {
+        try
+        {
+            func();
+        }
+        catch (...)
+        {
+            // keep the first exception, fetch_sub in finish() publishes it to the last task
+            if (!state->failed.exchange(true))
+            {
+                state->error = std::current_exception();
+            }
+        }
+        state->finish();
+    }
+};
+
+template <typename InputIt> std::future<void> ThreadPool::post_range(InputIt first, InputIt last)
+{
+    using Func = typename std::iterator_traits<InputIt>::value_type;
+    // the extra count held by the submitter keeps the batch open until every task is queued
+    std::shared_ptr<BulkState> state = std::make_shared<BulkState>(1);
+    std::future<void> result = state->promise.get_future();
+    std::vector<UniqueTask> tasks;
+    for (; first != last; ++first)
+    {
+        state->remaining++;
+        tasks.push_back(UniqueTask(BulkTask<Func>{state, Func(*first)}));
+    }
+    push_tasks(tasks.data(), tasks.size());
+    state->finish();
+    return result;
+}
+
+template <typename G> std::future<void> ThreadPool::post_range_n(size_t num_task, G gen)
+{
+    using Func = typename std::result_of<G(size_t)>::type;
+    std::shared_ptr<BulkState> state = std::make_shared<BulkState>(num_task + 1);
+    std::future<void> result = state->promise.get_future();
+    std::vector<UniqueTask> tasks;
+    tasks.reserve(num_task);
+    for (size_t i = 0; i < num_task; i++)
+    {
+        tasks.push_back(UniqueTask(BulkTask<Func>{state, gen(i)}));
     }
-    m_condition.notify_one();
+    push_tasks(tasks.data(), tasks.size());
+    state->finish();
     return result;
 }
 
@@ -0,0 +1,95 @@
+#include "ThreadPool.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+double queue_throughput(toys::QueueMode mode, int num_producer, int num_task)
+{
+    int num_worker = std::max(2u, std::thread::hardware_concurrency());
+    toys::ThreadPoolOptions options;
+    options.queue_mode = mode;
+    toys::ThreadPool tp(num_worker, options);
+    std::atomic<int> done(0);
+    std::vector<std::thread> producers;
+    auto start = std::chrono::steady_clock::now();
+    for (int p = 0; p < num_producer; p++)
+    {
+        producers.emplace_back([&tp, &done, num_producer, num_task]() {
+            for (int i = 0; i < num_task / num_producer; i++)
+            {
+                tp.post([&done]() { done.fetch_add(1, std::memory_order_relaxed); });
+            }
+        });
+    }
+    for (std::thread &producer : producers)
+    {
+        producer.join();
+    }
+    int total = num_task / num_producer * num_producer;
+    while (done.load() < total)
+    {
+        std::this_thread::yield();
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return total / elapsed.count() / 1e6;
+}
+
+// one task in flight at a time, the submitter sleeps gap_us between tasks so workers go idle;
+// returns the p50 and p99 delay from post() to the task starting, in microseconds
+void submit_latency(int idle_spin, int idle_yield, int gap_us, double &p50, double &p99)
+{
+    const int num_task = 2000;
+    int num_worker = std::max(2u, std::thread::hardware_concurrency());
+    toys::ThreadPoolOptions options;
+    options.idle_spin = idle_spin;
+    options.idle_yield = idle_yield;
+    toys::ThreadPool tp(num_worker, options);
+    std::vector<double> latencies(num_task);
+    for (int i = 0; i < num_task; i++)
+    {
+        std::this_thread::sleep_for(std::chrono::microseconds(gap_us));
+        std::atomic<bool> done(false);
+        auto submit = std::chrono::steady_clock::now();
+        tp.post([&latencies, &done, submit, i]() {
+            std::chrono::duration<double, std::micro> delay = std::chrono::steady_clock::now() - submit;
+            latencies[i] = delay.count();
+            done.store(true);
+        });
+        while (!done.load())
+        {
+            std::this_thread::yield();
+        }
+    }
+    std::sort(latencies.begin(), latencies.end());
+    p50 = latencies[num_task / 2];
+    p99 = latencies[num_task * 99 / 100];
+}
+
+int main(int argc, char **argv)
+{
+    const int num_task = 1 << 20;
+    printf("queue throughput, %d empty tasks, Mtasks/s\n", num_task);
+    printf("%10s %15s %15s\n", "producers", "CENTRAL_QUEUE", "LOCK_FREE");
+    for (int num_producer : {1, 4, 16, 64})
+    {
+        double central = queue_throughput(toys::CENTRAL_QUEUE, num_producer, num_task);
+        double lock_free = queue_throughput(toys::LOCK_FREE, num_producer, num_task);
+        printf("%10d %15.2f %15.2f\n", num_producer, central, lock_free);
+    }
+
+    printf("\nsubmit-to-start latency, CENTRAL_QUEUE, p50 / p99 us\n");
+    printf("%10s %18s %18s %18s\n", "gap us", "park", "yield, park", "spin, yield, park");
+    for (int gap_us : {10, 100, 1000})
+    {
+        double park[2], yield[2], spin[2];
+        submit_latency(0, 0, gap_us, park[0], park[1]);
+        submit_latency(0, 16, gap_us, yield[0], yield[1]);
+        submit_latency(4096, 16, gap_us, spin[0], spin[1]);
+        printf("%10d %8.1f / %7.1f %8.1f / %7.1f %8.1f / %7.1f\n", gap_us, park[0], park[1], yield[0], yield[1],
+               spin[0], spin[1]);
+    }
+    return 0;
+}
@@ -1,7 +1,10 @@
 #include "ThreadPool.hpp"
+#include <algorithm>
 #include <chrono>
 #include <iostream>
+#include <stdexcept>
 #include <thread>
+#include <vector>
 
 int func1(int a, int b)
 {
@@ -33,5 +36,156 @@ int main(int argc, char **argv)
     std::cout << f5.get() << std::endl;
     std::cout << f6.get() << std::endl;
 
+    tp.set_error_handler([](std::exception_ptr error) {
+        try
+        {
+            std::rethrow_exception(error);
+        }
+        catch (const std::exception &e)
+        {
+            std::cout << "post error: " << e.what() << std::endl;
+        }
+    });
+    tp.post([]() { std::cout << "post" << std::endl; });
+    tp.post([]() { throw std::runtime_error("oops"); });
+    tp.wait_idle();
+
+    // queued behind a busy pool, the high priority task starts before the earlier low priority one
+    toys::ThreadPool single(1);
+    single.post([]() { std::this_thread::sleep_for(std::chrono::milliseconds(100)); });
+    auto low = single.add_priority(toys::LOW_PRIORITY, []() { std::cout << "low" << std::endl; });
+    auto high = single.add_priority(toys::HIGH_PRIORITY, []() { std::cout << "high" << std::endl; });
+    low.wait();
+    high.wait();
+
+    // at most 2 queued tasks, try_add refuses the third instead of growing the queue
+    toys::ThreadPoolOptions bounded;
+    bounded.max_pending = 2;
+    toys::ThreadPool small(1, bounded);
+    small.post([]() { std::this_thread::sleep_for(std::chrono::milliseconds(100)); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    auto q1 = small.try_add([]() { return 1; });
+    auto q2 = small.try_add([]() { return 2; });
+    auto q3 = small.try_add([]() { return 3; });
+    std::cout << q1.valid() << q2.valid() << q3.valid() << " rejected " << small.num_rejected() << std::endl;
+    // runs what is queued, then stops the workers
+    small.shutdown(true);
+    std::cout << q1.get() + q2.get() << std::endl;
+
+    // per-worker counters are always on, collect_timing adds busy/idle time and latency histograms
+    toys::ThreadPoolOptions timed;
+    timed.collect_timing = true;
+    timed.trace_capacity = 4096;
+    toys::ThreadPool measured(2, timed);
+    for (int i = 0; i < 1000; i++)
+    {
+        measured.post_labeled(i % 2 == 0 ? "even" : "odd", []() {});
+    }
+    measured.wait_idle();
+    toys::ThreadPoolStats stats = measured.stats();
+    std::cout << stats.num_executed << " tasks, wait p99 " << stats.wait_ns.percentile(99) << " ns, run p99 "
+              << stats.run_ns.percentile(99) << " ns" << std::endl;
+    // timeline of the 1000 tasks, load it in chrome://tracing or ui.perfetto.dev
+    measured.dump_trace("thread_pool_trace.json");
+
+    // cancelling a fan-out: queued tasks are skipped, running ones stop at their next poll
+    toys::CancellationSource source;
+    toys::CancellationToken token = source.token();
+    std::vector<std::future<int>> parts;
+    for (int i = 0; i < 100; i++)
+    {
+        parts.push_back(measured.add_cancellable(token, [token](int part) {
+            for (int step = 0; step < 10; step++)
+            {
+                token.throw_if_cancelled();
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+            return part;
+        }, i));
+    }
+    source.cancel();
+    int num_cancelled = 0;
+    for (std::future<int> &part : parts)
+    {
+        try
+        {
+            part.get();
+        }
+        catch (const toys::TaskCancelled &)
+        {
+            num_cancelled++;
+        }
+    }
+    std::cout << num_cancelled << " of 100 cancelled" << std::endl;
+
+    // sharded counters: a shard is only ever touched by the worker its key maps to, so it needs no lock
+    std::vector<long> shards(16, 0);
+    for (int i = 0; i < 10000; i++)
+    {
+        int shard = i % 16;
+        measured.post_keyed(shard, [&shards, shard, i]() { shards[shard] += i; });
+    }
+    measured.wait_idle();
+    long sum = 0;
+    for (long shard : shards)
+    {
+        sum += shard;
+    }
+    std::cout << "sharded sum " << sum << std::endl;
+
+    // also on a full bounded pool: CALLER_RUNS would race with the shard's worker, keyed submissions wait instead
+    toys::ThreadPoolOptions bounded_keyed;
+    bounded_keyed.max_pending = 4;
+    bounded_keyed.overflow_policy = toys::CALLER_RUNS;
+    toys::ThreadPool keyed_pool(2, bounded_keyed);
+    std::fill(shards.begin(), shards.end(), 0);
+    for (int i = 0; i < 10000; i++)
+    {
+        int shard = i % 16;
+        keyed_pool.post_keyed(shard, [&shards, shard, i]() { shards[shard] += i; });
+    }
+    keyed_pool.wait_idle();
+    sum = 0;
+    for (long shard : shards)
+    {
+        sum += shard;
+    }
+    std::cout << "bounded sharded sum " << sum << std::endl;
+
+    // a worker waiting on I/O inside blocking() gets a stand-in, so compute tasks keep flowing on a small pool
+    toys::ThreadPool io_pool(1);
+    std::future<int> slow_read = io_pool.add([&io_pool]() {
+        return io_pool.blocking([]() {
+            std::this_thread::sleep_for(std::chrono::milliseconds(200)); // stands for a blocking read
+            return 42;
+        });
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    std::future<int> sum_of_squares = io_pool.add([]() {
+        int total = 0;
+        for (int i = 1; i <= 100; i++)
+        {
+            total += i * i;
+        }
+        return total;
+    });
+    std::cout << "computed " << sum_of_squares.get() << " while reading, read " << slow_read.get() << std::endl;
+
+    // tenant 0 floods the pool, tenant 1 still gets its quarter of the worker by weight
+    toys::ThreadPoolOptions shared;
+    shared.tenant_weights = {3, 1};
+    toys::ThreadPool tenants(1, shared);
+    for (int i = 0; i < 3000; i++)
+    {
+        tenants.post_tenant(0, []() { std::this_thread::sleep_for(std::chrono::microseconds(100)); });
+    }
+    std::future<int> answer = tenants.add_tenant(1, []() { return 42; });
+    std::cout << "tenant 1 answered " << answer.get() << " with " << tenants.stats().tenants[0].depth
+              << " tasks of tenant 0 still queued" << std::endl;
+    tenants.wait_idle();
+    toys::ThreadPoolStats tenant_stats = tenants.stats();
+    std::cout << "tenant 0 wait p99 " << tenant_stats.tenants[0].wait_ns.percentile(99) << " ns, tenant 1 wait p99 "
+              << tenant_stats.tenants[1].wait_ns.percentile(99) << " ns" << std::endl;
+
     return 0;
 }
\ No newline at end of file
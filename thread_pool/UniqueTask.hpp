@@ -0,0 +1,394 @@
+#pragma once
+#include <cstddef>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace toys
+{
+
+// Size-class free lists for small, short-lived objects (task nodes, promise shared states).
+// Each thread keeps a local cache and exchanges blocks with the global lists in batches.
+// Memory is retained for reuse and never returned to the system.
+class SlabPool
+{
+  private:
+    static constexpr size_t NUM_CLASSES = 4; // 64, 128, 256, 512 bytes
+    static constexpr size_t MIN_BLOCK_SIZE = 64;
+    static constexpr size_t BATCH_SIZE = 32;
+
+    struct Block
+    {
+        Block *next;
+    };
+    struct FreeList
+    {
+        Block *head;
+        size_t count;
+    };
+    struct LocalCache
+    {
+        FreeList lists[NUM_CLASSES];
+        LocalCache();
+        ~LocalCache();
+    };
+
+    // var
+    FreeList m_lists[NUM_CLASSES];
+    std::mutex m_lists_mutex;
+    // func
+    SlabPool();
+    static SlabPool &instance();
+    static LocalCache &local_cache();
+    static size_t size_class(size_t size);
+    void refill(FreeList &local, size_t cls);
+    void flush(FreeList &local, size_t cls, size_t keep);
+
+  public:
+    // func
+    static constexpr size_t MAX_BLOCK_SIZE = MIN_BLOCK_SIZE << (NUM_CLASSES - 1);
+    static void *allocate(size_t size);
+    static void deallocate(void *ptr, size_t size);
+};
+
+// std allocator adapter over SlabPool, used for std::promise shared states
+template <typename T> class SlabAllocator
+{
+  public:
+    using value_type = T;
+
+    SlabAllocator() = default;
+    template <typename U> SlabAllocator(const SlabAllocator<U> &)
+    {
+    }
+    T *allocate(size_t n);
+    void deallocate(T *ptr, size_t n);
+};
+
+template <typename T, typename U> bool operator==(const SlabAllocator<T> &, const SlabAllocator<U> &)
+{
+    return true;
+}
+
+template <typename T, typename U> bool operator!=(const SlabAllocator<T> &, const SlabAllocator<U> &)
+{
+    return false;
+}
+
+// Move-only type-erased void() callable. Callables up to INLINE_SIZE bytes are stored in place,
+// larger ones fall back to the heap.
+class UniqueTask
+{
+  private:
+    static constexpr size_t INLINE_SIZE = 56; // with the vtable pointer a task is one 64 byte block
+
+    struct VTable
+    {
+        void (*invoke)(void *storage);
+        void (*move)(void *dst, void *src);
+        void (*destroy)(void *storage);
+    };
+    template <typename F> struct InlineOps
+    {
+        static void invoke(void *storage);
+        static void move(void *dst, void *src);
+        static void destroy(void *storage);
+        static const VTable vtable;
+    };
+    template <typename F> struct HeapOps
+    {
+        static void invoke(void *storage);
+        static void move(void *dst, void *src);
+        static void destroy(void *storage);
+        static const VTable vtable;
+    };
+    template <typename F>
+    using fits_inline = std::integral_constant<bool, sizeof(F) <= INLINE_SIZE &&
+                                                         alignof(F) <= alignof(void *) &&
+                                                         std::is_nothrow_move_constructible<F>::value>;
+
+    // var
+    typename std::aligned_storage<INLINE_SIZE, alignof(void *)>::type m_storage;
+    const VTable *m_vtable;
+    // func
+    template <typename F> void construct(F &&f, std::true_type);
+    template <typename F> void construct(F &&f, std::false_type);
+    void reset();
+
+  public:
+    // func
+    UniqueTask();
+    template <typename F, typename = typename std::enable_if<
+                              !std::is_same<typename std::decay<F>::type, UniqueTask>::value>::type>
+    UniqueTask(F &&f);
+    UniqueTask(UniqueTask &&other) noexcept;
+    UniqueTask &operator=(UniqueTask &&other) noexcept;
+    UniqueTask(const UniqueTask &) = delete;
+    UniqueTask &operator=(const UniqueTask &) = delete;
+    ~UniqueTask();
+
+    explicit operator bool() const;
+    void operator()();
+
+    // task nodes for the work-stealing deques live in SlabPool
+    static UniqueTask *create(UniqueTask &&task);
+    static void destroy(UniqueTask *task_ptr);
+};
+
+SlabPool::SlabPool() : m_lists()
+{
+}
+
+SlabPool::LocalCache::LocalCache() : lists()
+{
+}
+
+SlabPool::LocalCache::~LocalCache()
+{
+    for (size_t cls = 0; cls < NUM_CLASSES; cls++)
+    {
+        instance().flush(lists[cls], cls, 0);
+    }
+}
+
+SlabPool &SlabPool::instance()
+{
+    // intentionally leaked, blocks may be released by thread_local caches during static destruction
+    static SlabPool *pool = new SlabPool();
+    return *pool;
+}
+
+SlabPool::LocalCache &SlabPool::local_cache()
+{
+    static thread_local LocalCache cache;
+    return cache;
+}
+
+size_t SlabPool::size_class(size_t size)
+{
+    size_t cls = 0;
+    size_t block_size = MIN_BLOCK_SIZE;
+    while (block_size < size)
+    {
+        block_size <<= 1;
+        cls++;
+    }
+    return cls;
+}
+
+void SlabPool::refill(FreeList &local, size_t cls)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_lists_mutex);
+        FreeList &global = m_lists[cls];
+        while (global.head != nullptr && local.count < BATCH_SIZE)
+        {
+            Block *block = global.head;
+            global.head = block->next;
+            global.count--;
+            block->next = local.head;
+            local.head = block;
+            local.count++;
+        }
+    }
+    if (local.head != nullptr)
+    {
+        return;
+    }
+    size_t block_size = MIN_BLOCK_SIZE << cls;
+    char *slab = static_cast<char *>(::operator new(block_size * BATCH_SIZE));
+    for (size_t i = 0; i < BATCH_SIZE; i++)
+    {
+        Block *block = reinterpret_cast<Block *>(slab + i * block_size);
+        block->next = local.head;
+        local.head = block;
+        local.count++;
+    }
+}
+
+void SlabPool::flush(FreeList &local, size_t cls, size_t keep)
+{
+    std::lock_guard<std::mutex> lock(m_lists_mutex);
+    FreeList &global = m_lists[cls];
+    while (local.count > keep)
+    {
+        Block *block = local.head;
+        local.head = block->next;
+        local.count--;
+        block->next = global.head;
+        global.head = block;
+        global.count++;
+    }
+}
+
+void *SlabPool::allocate(size_t size)
+{
+    if (size > MAX_BLOCK_SIZE)
+    {
+        return ::operator new(size);
+    }
+    size_t cls = size_class(size);
+    FreeList &local = local_cache().lists[cls];
+    if (local.head == nullptr)
+    {
+        instance().refill(local, cls);
+    }
+    Block *block = local.head;
+    local.head = block->next;
+    local.count--;
+    return block;
+}
+
+void SlabPool::deallocate(void *ptr, size_t size)
+{
+    if (size > MAX_BLOCK_SIZE)
+    {
+        ::operator delete(ptr);
+        return;
+    }
+    size_t cls = size_class(size);
+    FreeList &local = local_cache().lists[cls];
+    Block *block = static_cast<Block *>(ptr);
+    block->next = local.head;
+    local.head = block;
+    local.count++;
+    if (local.count >= 2 * BATCH_SIZE)
+    {
+        // blocks drift from consumer to producer threads, hand the surplus back
+        instance().flush(local, cls, BATCH_SIZE);
+    }
+}
+
+template <typename T> T *SlabAllocator<T>::allocate(size_t n)
+{
+    return static_cast<T *>(SlabPool::allocate(n * sizeof(T)));
+}
+
+template <typename T> void SlabAllocator<T>::deallocate(T *ptr, size_t n)
+{
+    SlabPool::deallocate(ptr, n * sizeof(T));
+}
+
+template <typename F> void UniqueTask::InlineOps<F>::invoke(void *storage)
+{
+    (*static_cast<F *>(storage))();
+}
+
+template <typename F> void UniqueTask::InlineOps<F>::move(void *dst, void *src)
+{
+    new (dst) F(std::move(*static_cast<F *>(src)));
+    static_cast<F *>(src)->~F();
+}
+
+template <typename F> void UniqueTask::InlineOps<F>::destroy(void *storage)
+{
+    static_cast<F *>(storage)->~F();
+}
+
+template <typename F>
+const UniqueTask::VTable UniqueTask::InlineOps<F>::vtable = {&InlineOps<F>::invoke, &InlineOps<F>::move,
+                                                             &InlineOps<F>::destroy};
+
+template <typename F> void UniqueTask::HeapOps<F>::invoke(void *storage)
+{
+    (**static_cast<F **>(storage))();
+}
+
+template <typename F> void UniqueTask::HeapOps<F>::move(void *dst, void *src)
+{
+    *static_cast<F **>(dst) = *static_cast<F **>(src);
+}
+
+template <typename F> void UniqueTask::HeapOps<F>::destroy(void *storage)
+{
+    delete *static_cast<F **>(storage);
+}
+
+template <typename F>
+const UniqueTask::VTable UniqueTask::HeapOps<F>::vtable = {&HeapOps<F>::invoke, &HeapOps<F>::move,
+                                                           &HeapOps<F>::destroy};
+
+UniqueTask::UniqueTask() : m_vtable(nullptr)
+{
+}
+
+template <typename F, typename> UniqueTask::UniqueTask(F &&f) : m_vtable(nullptr)
+{
+    construct(std::forward<F>(f), fits_inline<typename std::decay<F>::type>());
+}
+
+template <typename F> void UniqueTask::construct(F &&f, std::true_type)
+{
+    using Func = typename std::decay<F>::type;
+    new (&m_storage) Func(std::forward<F>(f));
+    m_vtable = &InlineOps<Func>::vtable;
+}
+
+template <typename F> void UniqueTask::construct(F &&f, std::false_type)
+{
+    using Func = typename std::decay<F>::type;
+    *reinterpret_cast<Func **>(&m_storage) = new Func(std::forward<F>(f));
+    m_vtable = &HeapOps<Func>::vtable;
+}
+
+UniqueTask::UniqueTask(UniqueTask &&other) noexcept : m_vtable(other.m_vtable)
+{
+    if (m_vtable != nullptr)
+    {
+        m_vtable->move(&m_storage, &other.m_storage);
+        other.m_vtable = nullptr;
+    }
+}
+
+UniqueTask &UniqueTask::operator=(UniqueTask &&other) noexcept
+{
+    if (this != &other)
+    {
+        reset();
+        m_vtable = other.m_vtable;
+        if (m_vtable != nullptr)
+        {
+            m_vtable->move(&m_storage, &other.m_storage);
+            other.m_vtable = nullptr;
+        }
+    }
+    return *this;
+}
+
+UniqueTask::~UniqueTask()
+{
+    reset();
+}
+
+void UniqueTask::reset()
+{
+    if (m_vtable != nullptr)
+    {
+        m_vtable->destroy(&m_storage);
+        m_vtable = nullptr;
+    }
+}
+
+UniqueTask::operator bool() const
+{
+    return m_vtable != nullptr;
+}
+
+void UniqueTask::operator()()
+{
+    m_vtable->invoke(&m_storage);
+}
+
+UniqueTask *UniqueTask::create(UniqueTask &&task)
+{
+    return new (SlabPool::allocate(sizeof(UniqueTask))) UniqueTask(std::move(task));
+}
+
+void UniqueTask::destroy(UniqueTask *task_ptr)
+{
+    task_ptr->~UniqueTask();
+    SlabPool::deallocate(task_ptr, sizeof(UniqueTask));
+}
+
+} // namespace toys
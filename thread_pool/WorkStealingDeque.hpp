@@ -0,0 +1,156 @@
+/*
+reference:
+https://fzn.fr/readings/ppopp13.pdf (Correct and Efficient Work-Stealing for Weak Memory Models)
+*/
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace toys
+{
+
+// Chase-Lev deque. The owner thread calls push/pop at the bottom, any other thread calls steal at the top.
+// T must be trivially copyable (the pool stores task pointers).
+template <typename T> class WorkStealingDeque
+{
+  private:
+    struct Array
+    {
+        int64_t capacity;
+        int64_t mask;
+        std::unique_ptr<std::atomic<T>[]> slots;
+
+        Array(int64_t capacity);
+        T get(int64_t i);
+        void put(int64_t i, T value);
+        Array *grow(int64_t bottom, int64_t top);
+    };
+
+    // var
+    // padded instead of alignas(64) so the deque can be heap allocated before C++17 aligned new
+    std::atomic<int64_t> m_top;
+    char m_top_pad[64 - sizeof(std::atomic<int64_t>)];
+    std::atomic<int64_t> m_bottom;
+    char m_bottom_pad[64 - sizeof(std::atomic<int64_t>)];
+    std::atomic<Array *> m_array;
+    std::vector<std::unique_ptr<Array>> m_arrays; // retired arrays may still be read by thieves, free them last
+
+  public:
+    // func
+    WorkStealingDeque(int64_t capacity = 256);
+    WorkStealingDeque(const WorkStealingDeque &) = delete;
+    WorkStealingDeque &operator=(const WorkStealingDeque &) = delete;
+    ~WorkStealingDeque() = default;
+
+    void push(T value);
+    bool pop(T &value);
+    bool steal(T &value);
+    int64_t size();
+    bool empty();
+};
+
+template <typename T>
+WorkStealingDeque<T>::Array::Array(int64_t capacity)
+    : capacity(capacity), mask(capacity - 1), slots(new std::atomic<T>[capacity])
+{
+}
+
+template <typename T> T WorkStealingDeque<T>::Array::get(int64_t i)
+{
+    return slots[i & mask].load(std::memory_order_acquire);
+}
+
+template <typename T> void WorkStealingDeque<T>::Array::put(int64_t i, T value)
+{
+    slots[i & mask].store(value, std::memory_order_release);
+}
+
+template <typename T>
+typename WorkStealingDeque<T>::Array *WorkStealingDeque<T>::Array::grow(int64_t bottom, int64_t top)
+{
+    Array *array = new Array(capacity * 2);
+    for (int64_t i = top; i < bottom; i++)
+    {
+        array->put(i, get(i));
+    }
+    return array;
+}
+
+template <typename T> WorkStealingDeque<T>::WorkStealingDeque(int64_t capacity) : m_top(0), m_bottom(0)
+{
+    int64_t real_capacity = 1;
+    while (real_capacity < capacity)
+    {
+        real_capacity <<= 1;
+    }
+    m_arrays.emplace_back(new Array(real_capacity));
+    m_array.store(m_arrays.back().get(), std::memory_order_relaxed);
+}
+
+template <typename T> void WorkStealingDeque<T>::push(T value)
+{
+    int64_t bottom = m_bottom.load(std::memory_order_relaxed);
+    int64_t top = m_top.load(std::memory_order_acquire);
+    Array *array = m_array.load(std::memory_order_relaxed);
+    if (bottom - top > array->capacity - 1)
+    {
+        array = array->grow(bottom, top);
+        m_arrays.emplace_back(array);
+        m_array.store(array, std::memory_order_release);
+    }
+    array->put(bottom, value);
+    m_bottom.store(bottom + 1, std::memory_order_release);
+}
+
+template <typename T> bool WorkStealingDeque<T>::pop(T &value)
+{
+    int64_t bottom = m_bottom.load(std::memory_order_relaxed) - 1;
+    Array *array = m_array.load(std::memory_order_relaxed);
+    m_bottom.store(bottom, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t top = m_top.load(std::memory_order_relaxed);
+    if (top > bottom)
+    {
+        m_bottom.store(bottom + 1, std::memory_order_relaxed);
+        return false;
+    }
+    value = array->get(bottom);
+    if (top == bottom)
+    {
+        // last element, race against thieves
+        bool won = m_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+        m_bottom.store(bottom + 1, std::memory_order_relaxed);
+        return won;
+    }
+    return true;
+}
+
+template <typename T> bool WorkStealingDeque<T>::steal(T &value)
+{
+    int64_t top = m_top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t bottom = m_bottom.load(std::memory_order_acquire);
+    if (top >= bottom)
+    {
+        return false;
+    }
+    Array *array = m_array.load(std::memory_order_acquire);
+    value = array->get(top);
+    return m_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+}
+
+template <typename T> int64_t WorkStealingDeque<T>::size()
+{
+    int64_t bottom = m_bottom.load(std::memory_order_relaxed);
+    int64_t top = m_top.load(std::memory_order_relaxed);
+    return bottom > top ? bottom - top : 0;
+}
+
+template <typename T> bool WorkStealingDeque<T>::empty()
+{
+    return size() == 0;
+}
+
+} // namespace toys